@@ -9,59 +9,68 @@
 
 namespace game {
 
-Action::Action(Color color, int index) {
+template <int board_size>
+Action<board_size>::Action(Color color, int index) {
   assert(color != EMPTY);
-  assert(0 <= index && index <= BOARD_SIZE * BOARD_SIZE + 1);
+  assert(0 <= index && index <= board_size * board_size + 1);
   value_ = index + 1;
   value_ *= (color == BLACK ? 1 : -1);
 }
 
-Action::Action(Color color, ActionType action_type, int x, int y) {
+template <int board_size>
+Action<board_size>::Action(Color color, ActionType action_type, int x, int y) {
   assert(color != EMPTY);
-  assert(0 <= x && x < BOARD_SIZE && 0 <= y && y < BOARD_SIZE);
+  assert(0 <= x && x < board_size && 0 <= y && y < board_size);
   switch (action_type) {
   case PLAY: {
-    value_ = x * BOARD_SIZE + y + 1;
+    value_ = x * board_size + y + 1;
     break;
   }
   case PASS: {
-    value_ = BOARD_SIZE * BOARD_SIZE + 1;
+    value_ = board_size * board_size + 1;
     break;
   }
   case RESIGN: {
-    value_ = BOARD_SIZE * BOARD_SIZE + 2;
+    value_ = board_size * board_size + 2;
     break;
   }
   }
   value_ *= (color == BLACK ? 1 : -1);
 }
 
-Color Action::get_color() const { return value_ > 0 ? BLACK : WHITE; }
+template <int board_size> Color Action<board_size>::get_color() const {
+  return value_ > 0 ? BLACK : WHITE;
+}
 
-ActionType Action::get_type() const {
+template <int board_size>
+ActionType Action<board_size>::get_type() const {
   switch (value_ > 0 ? value_ : -value_) {
-  case (BOARD_SIZE * BOARD_SIZE + 1):
+  case (board_size * board_size + 1):
     return PASS;
-  case (BOARD_SIZE * BOARD_SIZE + 2):
+  case (board_size * board_size + 2):
     return RESIGN;
   default:
     return PLAY;
   }
 }
 
-int Action::get_x() const {
-  assert((abs(value_) - 1) < BOARD_SIZE * BOARD_SIZE);
-  return (abs(value_) - 1) / BOARD_SIZE;
+template <int board_size>
+int Action<board_size>::get_x() const {
+  assert((abs(value_) - 1) < board_size * board_size);
+  return (abs(value_) - 1) / board_size;
 }
 
-int Action::get_y() const {
-  assert((abs(value_) - 1) < BOARD_SIZE * BOARD_SIZE);
-  return (abs(value_) - 1) % BOARD_SIZE;
+template <int board_size>
+int Action<board_size>::get_y() const {
+  assert((abs(value_) - 1) < board_size * board_size);
+  return (abs(value_) - 1) % board_size;
 }
 
-int Action::get_index() const { return abs(value_) - 1; }
+template <int board_size>
+int Action<board_size>::get_index() const { return abs(value_) - 1; }
 
-std::string Action::to_string() const {
+template <int board_size>
+std::string Action<board_size>::to_string() const {
   switch (get_type()) {
   case PASS:
     return "PASS";
@@ -74,7 +83,8 @@ std::string Action::to_string() const {
   return {};
 }
 
-std::string Action::to_gtp_string() const {
+template <int board_size>
+std::string Action<board_size>::to_gtp_string() const {
   switch (get_type()) {
   case PASS:
     return "= PASS\n";
@@ -84,12 +94,13 @@ std::string Action::to_gtp_string() const {
     std::string ret = "= ";
     // why does gtp make I an illegal coordinate wtf
     ret += static_cast<char>('A' + get_y() + (get_y() >= 8));
-    ret += static_cast<char>('9' - get_x());
+    ret += std::to_string(board_size - get_x());
     return ret + "\n";
   }
 }
 
-std::string Action::to_sgf_string() const {
+template <int board_size>
+std::string Action<board_size>::to_sgf_string() const {
   if (get_type() == RESIGN) {
     return {};
   }
@@ -102,18 +113,25 @@ std::string Action::to_sgf_string() const {
   return return_string;
 }
 
-Action Action::from_action(const std::string &s) {
+template <int board_size>
+Action<board_size> Action<board_size>::from_action(const std::string &s) {
   if (s.size() < 9) {
     throw std::invalid_argument("Invalid action: " + s);
   }
   Color c = (s[5] == 'b' ? BLACK : WHITE);
-  // coordinate; must be a play
-  if (s[7] < 'p') {
-    return {c, PLAY, '9' - s[8], (s[7] < 'j') ? s[7] - 'a' : s[7] - 'b'};
-  } else if (s.substr(7, 4) == "pass") {
+  if (s.substr(7, 4) == "pass") {
     return {c, PASS};
+  } else if (s.substr(7, 6) == "resign") {
+    return {c, RESIGN};
   }
-  return {c, RESIGN};
+  // coordinate; must be a play. columns skip the letter i, rows count up
+  // from the bottom of the board
+  return {c, PLAY, board_size - std::stoi(s.substr(8)),
+          (s[7] < 'j') ? s[7] - 'a' : s[7] - 'b'};
 }
 
+template class Action<9>;
+template class Action<13>;
+template class Action<19>;
+
 } // namespace game
\ No newline at end of file
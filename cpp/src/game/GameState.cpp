@@ -3,110 +3,140 @@
 //
 
 #include "game/GameState.h"
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <iostream>
-#include <memory>
 #include <stdexcept>
 
 namespace game {
 
-GameState::GameState(float komi, const std::shared_ptr<Zobrist> &zobrist)
+template <int board_size>
+GameState<board_size>::GameState(float komi, const Zobrist *zobrist,
+                                 bool positional_superko)
     : turn_(BLACK), winner_(EMPTY), komi_(komi), turns_(0), passes_(0),
-      done_(false) {
-  if (zobrist == nullptr) {
-    zobrist_ = std::make_shared<Zobrist>(BOARD_SIZE * BOARD_SIZE * 2 + 1);
-  } else {
-    zobrist_ = zobrist;
-    assert(zobrist_->size() >= BOARD_SIZE * BOARD_SIZE * 2 + 1);
+      done_(false), head_(0), num_legal_actions_(0),
+      legal_actions_ready_(false), num_hashes_(0),
+      positional_superko_(positional_superko), zobrist_(zobrist) {
+  if (zobrist_ == nullptr) {
+    // shared by every state that isn't given its own table
+    static const Zobrist default_zobrist(board_size * board_size * 2 + 1);
+    zobrist_ = &default_zobrist;
   }
+  assert(zobrist_->size() >= board_size * board_size * 2 + 1);
   std::memset(boards_, 0, sizeof(boards_));
+  std::memset(board_hashes_, 0, sizeof(board_hashes_));
+  std::memset(chain_next_, 0, sizeof(chain_next_));
+  std::memset(chain_head_, 0, sizeof(chain_head_));
+  std::memset(chain_size_, 0, sizeof(chain_size_));
   std::memset(liberties_, 0, sizeof(liberties_));
-  for (int i = 0; i < BOARD_SIZE * BOARD_SIZE + 1; ++i) {
-    legal_action_idxes_.push_back(i);
-  }
-  for (auto &uf_chain : uf_chains_) {
-    for (auto &y : uf_chain) {
-      y = std::make_pair(-1, -1);
-    }
-  }
+  std::memset(seen_filter_, 0, sizeof(seen_filter_));
+  legal_[0] = BitBoard<board_size>::full();
+  legal_[1] = BitBoard<board_size>::full();
   // black moves first; all other features are off on the empty board
-  hash_ = zobrist_->get_value(BOARD_SIZE * BOARD_SIZE * 2);
+  hash_ = zobrist_->get_value(board_size * board_size * 2);
+  record_position_();
 }
 
-Color GameState::get_turn() const {
+template <int board_size>
+Color GameState<board_size>::get_turn() const {
   assert(!done_);
   return turn_;
 }
 
-int GameState::get_num_turns() const { return turns_; }
+template <int board_size>
+int GameState<board_size>::get_num_turns() const { return turns_; }
 
-const Color *GameState::get_board(int i) const { return &boards_[i][0][0]; }
+template <int board_size>
+int GameState<board_size>::get_passes() const { return passes_; }
 
-float GameState::get_komi() const { return komi_; }
+template <int board_size>
+const Color *GameState<board_size>::get_board(int i) const {
+  assert(0 <= i && i < GAME_HISTORY_LEN);
+  return &boards_[(head_ + i) % GAME_HISTORY_LEN][0][0];
+}
 
-bool GameState::done() const { return done_; }
+template <int board_size>
+float GameState<board_size>::get_komi() const { return komi_; }
 
-Color GameState::winner() const { return winner_; }
+template <int board_size>
+bool GameState<board_size>::done() const { return done_; }
 
-float GameState::score() const {
-  bool white_reachable[BOARD_SIZE][BOARD_SIZE];
-  bool black_reachable[BOARD_SIZE][BOARD_SIZE];
-  memset(white_reachable, false, sizeof(white_reachable));
-  memset(black_reachable, false, sizeof(black_reachable));
-  for (int x = 0; x < BOARD_SIZE; ++x) {
-    for (int y = 0; y < BOARD_SIZE; ++y) {
-      if (boards_[0][x][y] == BLACK) {
-        dfs_score_(x, y, WHITE, black_reachable);
-      } else if (boards_[0][x][y] == WHITE) {
-        dfs_score_(x, y, BLACK, white_reachable);
-      }
-    }
-  }
-  float count = -komi_;
-  for (int x = 0; x < BOARD_SIZE; ++x) {
-    for (int y = 0; y < BOARD_SIZE; ++y) {
-      if (white_reachable[x][y] && !black_reachable[x][y])
-        --count;
-      else if (black_reachable[x][y] && !white_reachable[x][y])
-        ++count;
+template <int board_size>
+Color GameState<board_size>::winner() const { return winner_; }
+
+template <int board_size>
+float GameState<board_size>::score() const {
+  const BitBoard<board_size> black_reachable = reachable_(0);
+  const BitBoard<board_size> white_reachable = reachable_(1);
+  return static_cast<float>((black_reachable & ~white_reachable).count() -
+                            (white_reachable & ~black_reachable).count()) -
+         komi_;
+}
+
+template <int board_size>
+void GameState<board_size>::get_ownership(Color *ownership) const {
+  const BitBoard<board_size> black_reachable = reachable_(0);
+  const BitBoard<board_size> white_reachable = reachable_(1);
+  for (int i = 0; i < board_size * board_size; ++i) {
+    if (black_reachable.test(i) == white_reachable.test(i)) {
+      ownership[i] = EMPTY;
+    } else {
+      ownership[i] = black_reachable.test(i) ? BLACK : WHITE;
     }
   }
-  return count;
 }
 
-bool GameState::is_legal_action(Action action) const {
+template <int board_size>
+bool GameState<board_size>::is_legal_action(Action<board_size> action) const {
   // return (turn_ != action.get_color() || done_)
   if (turn_ != action.get_color() || done_) {
     std::cout << "Different color turn or done\n";
     return false;
   }
-  if (action.get_type() == RESIGN) {
+  if (action.get_type() == PASS || action.get_type() == RESIGN) {
     return true;
   }
-  return std::find(legal_action_idxes_.begin(), legal_action_idxes_.end(),
-                   action.get_index()) != legal_action_idxes_.end();
-  /* if (action.get_type() == PASS || action.get_type() == RESIGN)
-    return true;
-  return is_legal_play_(action.get_x(), action.get_y(), action.get_color()); */
+  if (legal_actions_ready_) {
+    return legal_actions_.test(action.get_index());
+  }
+  return legal_[turn_ == BLACK ? 0 : 1].test(action.get_index()) &&
+         !repeats_history_(action.get_x(), action.get_y());
 }
 
-const std::vector<int> *GameState::get_legal_action_indexes() const {
-  // action indexes go from 0 to BOARD_SIZE * BOARD_SIZE + 1
+template <int board_size>
+std::span<const int> GameState<board_size>::get_legal_action_indexes() const {
+  // action indexes go from 0 to board_size * board_size + 1
   // does NOT include resign, as stated in the header
   if (done_) {
-    return nullptr;
+    return {};
   }
-  return &legal_action_idxes_;
+  if (!legal_actions_ready_) {
+    list_legal_actions_();
+  }
+  return {legal_action_idxes_, static_cast<size_t>(num_legal_actions_)};
 }
 
-void GameState::move(Action action) {
+template <int board_size>
+void GameState<board_size>::move(Action<board_size> action, Undo *undo) {
   if (!is_legal_action(action)) {
     throw std::invalid_argument("illegal action played");
   }
+  if (undo != nullptr) {
+    undo->turn_ = turn_;
+    undo->winner_ = winner_;
+    undo->hash_ = hash_;
+    undo->turns_ = turns_;
+    undo->passes_ = passes_;
+    undo->head_ = head_;
+    undo->num_hashes_ = num_hashes_;
+    undo->filter_word_ = -1;
+    undo->play_ = action.get_type() == PLAY;
+    undo->num_merges_ = 0;
+  }
   ++turns_;
   turn_ = opposite(turn_);
-  hash_ ^= zobrist_->get_value(BOARD_SIZE * BOARD_SIZE * 2);
+  hash_ ^= zobrist_->get_value(board_size * board_size * 2);
   switch (action.get_type()) {
   case RESIGN: {
     done_ = true;
@@ -128,170 +158,126 @@ void GameState::move(Action action) {
   }
   case PLAY: {
     passes_ = 0;
-    // shift all game history by 1
-    for (int i = 7; i > 0; --i) {
-      memcpy(boards_[i], boards_[i - 1], sizeof(boards_[i]));
+    // the oldest board in the history ring becomes the new current board;
+    // only this one board is written per move
+    const int new_head = (head_ + GAME_HISTORY_LEN - 1) % GAME_HISTORY_LEN;
+    if (undo != nullptr) {
+      memcpy(undo->evicted_board_, boards_[new_head],
+             sizeof(undo->evicted_board_));
+      undo->evicted_hash_ = board_hashes_[new_head];
     }
+    memcpy(boards_[new_head], boards_[head_], sizeof(boards_[new_head]));
+    head_ = new_head;
     // update current board:
-    // 1. place current stone + update hash + current stone's UF chain
+    // 1. place current stone + update hash + current stone's chain
     // 2. remove dead neighbors (if any) and update hash
-    // 3. if capture, recount all liberties of our color's groups
+    // 3. if capture, recount liberties of our groups next to captured stones
     // 4. if not capture, recount liberties of placed stone's group
+    // 5. recompute legality of points next to anything that changed
     int x = action.get_x();
     int y = action.get_y();
+    const int index = x * board_size + y;
+    const Color color = action.get_color();
+    const int own = (color == BLACK ? 0 : 1);
+    if (undo != nullptr) {
+      undo->placed_ = index;
+      undo->placed_chain_[0] = chain_next_[index];
+      undo->placed_chain_[1] = chain_head_[index];
+      undo->placed_chain_[2] = chain_size_[index];
+      undo->placed_chain_[3] = liberties_[index];
+    }
     // 1
-    boards_[0][x][y] = action.get_color();
+    boards_[head_][x][y] = color;
+    stones_[own].set(index);
     // turn_ is already updated to the opposite color
-    hash_ ^= zobrist_->get_value(
-        (action.get_color() == BLACK ? 0 : BOARD_SIZE * BOARD_SIZE) +
-        (x * BOARD_SIZE + y));
-    uf_make_(x, y);
-    bool capture = false;
+    hash_ ^= zobrist_->get_value(stone_feature_(color, index));
+    chain_make_(index);
+    // stones whose chain changed size or liberties
+    BitBoard<board_size> changed = BitBoard<board_size>::single(index);
+    BitBoard<board_size> captured;
     // 2
-    std::set<std::pair<int, int>> neighbor_set;
+    int neighbor_heads[4];
+    int num_neighbor_heads = 0;
     for (const auto a : neighbors) {
-      if (0 <= a[0] + x && a[0] + x < BOARD_SIZE && 0 <= a[1] + y &&
-          a[1] + y < BOARD_SIZE) {
-        if (boards_[0][a[0] + x][a[1] + y] == action.get_color()) {
-          uf_union_(x, y, a[0] + x, a[1] + y);
-        } else if (boards_[0][a[0] + x][a[1] + y] ==
-                   opposite(action.get_color())) {
-          std::pair<int, int> head = uf_find_(a[0] + x, a[1] + y);
-          if (!neighbor_set.contains(head) &&
-              --(liberties_[head.first][head.second]) == 0) {
+      if (0 <= a[0] + x && a[0] + x < board_size && 0 <= a[1] + y &&
+          a[1] + y < board_size) {
+        const int neighbor = (a[0] + x) * board_size + (a[1] + y);
+        if (boards_[head_][a[0] + x][a[1] + y] == color) {
+          const int merged = chain_merge_(index, neighbor);
+          if (undo != nullptr && merged >= 0) {
+            undo->merges_[undo->num_merges_][0] = chain_head_[index];
+            undo->merges_[undo->num_merges_++][1] = merged;
+          }
+        } else if (boards_[head_][a[0] + x][a[1] + y] == opposite(color)) {
+          const int head = chain_head_[neighbor];
+          // if neighbors are part of same group, we don't want to subtract
+          // more than 1 liberty
+          if (std::find(neighbor_heads, neighbor_heads + num_neighbor_heads,
+                        head) != neighbor_heads + num_neighbor_heads) {
+            continue;
+          }
+          neighbor_heads[num_neighbor_heads++] = head;
+          if (--(liberties_[head]) == 0) {
             // remove dead neighbors
-            for (const std::pair<int, int> &stone :
-                 chain_lists_[head.first][head.second]) {
-              hash_ ^= zobrist_->get_value(
-                  (boards_[0][stone.first][stone.second] == BLACK
-                       ? 0
-                       : BOARD_SIZE * BOARD_SIZE) +
-                  (x * BOARD_SIZE + y));
-              boards_[0][stone.first][stone.second] = EMPTY;
-            }
-            capture = true;
-            uf_delete_(head.first, head.second);
+            int stone = head;
+            do {
+              Color &point =
+                  boards_[head_][stone / board_size][stone % board_size];
+              hash_ ^= zobrist_->get_value(stone_feature_(point, stone));
+              point = EMPTY;
+              captured.set(stone);
+              stone = chain_next_[stone];
+            } while (stone != head);
             // liberties are already at 0, no need to update them
+          } else {
+            changed |= chain_mask_(head);
           }
-          // if neighbors are part of same group, we don't want to subtract more
-          // than 1 liberty
-          neighbor_set.insert(head);
         }
       }
     }
-    // 3
-    if (capture) {
-      for (int x0 = 0; x0 < BOARD_SIZE; ++x0) {
-        for (int y0 = 0; y0 < BOARD_SIZE; ++y0) {
-          if (boards_[0][x0][y0] == action.get_color() &&
-              !chain_lists_[x0][y0].empty()) {
-            update_liberties_at_head_(x0, y0);
-          }
-        }
+    stones_[1 - own] &= ~captured;
+    if (undo != nullptr) {
+      undo->captured_ = captured;
+    }
+    if (!captured.empty()) {
+      // 3
+      BitBoard<board_size> to_update = captured.neighbors() & stones_[own];
+      while (!to_update.empty()) {
+        const int head = chain_head_[to_update.lowest()];
+        update_liberties_at_head_(head);
+        BitBoard<board_size> chain = chain_mask_(head);
+        changed |= chain;
+        to_update &= ~chain;
       }
     } else {
       // 4
-      std::pair<int, int> head = uf_find_(x, y);
-      update_liberties_at_head_(head.first, head.second);
+      const int head = chain_head_[index];
+      update_liberties_at_head_(head);
+      changed |= chain_mask_(head);
     }
+    // 5
+    update_legal_(changed | captured);
+    board_hashes_[head_] =
+        turn_ == BLACK
+            ? hash_ ^ zobrist_->get_value(board_size * board_size * 2)
+            : hash_;
     break;
   }
   }
 
-  // calculate all legal actions
-  legal_action_idxes_.clear();
-  Color original_board[BOARD_SIZE][BOARD_SIZE];
-  memcpy(original_board, boards_[0], sizeof(original_board));
-  bool dirty_board = false;
-  for (int x = 0; x < BOARD_SIZE; ++x) {
-    for (int y = 0; y < BOARD_SIZE; ++y) {
-      // reset to original board
-      if (dirty_board) {
-        memcpy(boards_[0], original_board, sizeof(original_board));
-        dirty_board = false;
-      }
-      // action is legal if:
-      // 1. empty space
-      // 2. no chain of 4 stones
-      // 3. if a capture, it does not repeat previous game state
-      // 4. if not a capture, it cannot be a suicide
-      // 1
-      if (boards_[0][x][y] != EMPTY) {
-        continue;
-      }
-      // 2
-      // ext_lib is for checking 4) later
-      bool ext_lib = false;
-      std::set<std::pair<int, int>> chain_heads;
-      for (const auto a : neighbors) {
-        if (0 <= a[0] + x && a[0] + x < BOARD_SIZE && 0 <= a[1] + y &&
-            a[1] + y < BOARD_SIZE) {
-          if (boards_[0][a[0] + x][a[1] + y] == turn_) {
-            chain_heads.insert(uf_find_(a[0] + x, a[1] + y));
-          } else if (boards_[0][a[0] + x][a[1] + y] == EMPTY) {
-            ext_lib = true;
-          }
-        }
-      }
-      size_t stone_count = 0;
-      for (const std::pair<int, int> &head : chain_heads) {
-        stone_count += chain_lists_[head.first][head.second].size();
-      }
-      // adding a new stone to this would make a 4-chain
-      if (stone_count == 3) {
-        continue;
-      }
-      // 3
-      bool capture = false;
-      Color opposite_c = opposite(turn_);
-      for (const auto a : neighbors) {
-        if (0 <= a[0] + x && a[0] + x < BOARD_SIZE && 0 <= a[1] + y &&
-            a[1] + y < BOARD_SIZE &&
-            boards_[0][a[0] + x][a[1] + y] == opposite_c) {
-          std::pair<int, int> head = uf_find_(a[0] + x, a[1] + y);
-          if (liberties_[head.first][head.second] == 1) {
-            capture = true;
-            dirty_board = true;
-            // only temporarily removing from the board
-            for (const std::pair<int, int> &stone :
-                 chain_lists_[head.first][head.second]) {
-              boards_[0][stone.first][stone.second] = EMPTY;
-            }
-          }
-        }
-      }
-      if (capture) {
-        // place the actual stone
-        boards_[0][x][y] = turn_;
-        bool kill = false;
-        for (int i = 1; i < GAME_HISTORY_LEN; i += 2) {
-          if (memcmp(boards_[0], boards_[i], sizeof(boards_[0])) == 0) {
-            kill = true;
-            break;
-          }
-        }
-        if (kill) {
-          continue;
-        }
-      } else if (!ext_lib) {
-        for (const std::pair<int, int> &head : chain_heads) {
-          assert(liberties_[head.first][head.second] >= 1);
-          if (liberties_[head.first][head.second] > 1) {
-            legal_action_idxes_.push_back(x * BOARD_SIZE + y);
-            break;
-          }
-        }
-        continue;
-      }
-      legal_action_idxes_.push_back(x * BOARD_SIZE + y);
-    }
+#ifdef ROOST_VERIFY_HASH
+  if (hash_ != compute_hash()) {
+    throw std::logic_error("incremental hash differs from recomputed hash");
   }
-  legal_action_idxes_.push_back(BOARD_SIZE * BOARD_SIZE);
-  // restore original board
-  if (dirty_board) {
-    memcpy(boards_[0], original_board, sizeof(original_board));
+#endif
+  if (undo != nullptr) {
+    undo->filter_word_ =
+        static_cast<int>(hash_ % (SEEN_FILTER_WORDS * 64) / 64);
+    undo->filter_bits_ = seen_filter_[undo->filter_word_];
   }
-  if (turns_ >= MAX_GAME_LENGTH) {
+  record_position_();
+  legal_actions_ready_ = false;
+  if (turns_ >= MAX_GAME_LENGTH(board_size)) {
     done_ = true;
     float game_score = score();
     if (game_score > 1e-8)
@@ -301,15 +287,96 @@ void GameState::move(Action action) {
   }
 }
 
-size_t GameState::hash() const { return hash_; }
+template <int board_size>
+void GameState<board_size>::undo_move(const Undo &undo) {
+  if (undo.play_) {
+    // chains and liberties are restored from the stones around the move
+    const int own = (undo.turn_ == BLACK ? 0 : 1);
+    const int index = undo.placed_;
+    const BitBoard<board_size> &captured = undo.captured_;
+    for (int i = undo.num_merges_ - 1; i >= 0; --i) {
+      chain_split_(undo.merges_[i][0], undo.merges_[i][1]);
+    }
+    stones_[own].reset(index);
+    stones_[1 - own] |= captured;
+    // the move wrote its board into the slot that held the oldest board, so
+    // put the evicted board back there; the previous board in the slot after
+    // it was never written, so moving head_ back makes it current again
+    memcpy(boards_[head_], undo.evicted_board_, sizeof(boards_[head_]));
+    board_hashes_[head_] = undo.evicted_hash_;
+    head_ = undo.head_;
+    // captured chains kept their links, and only chains next to the move
+    // or to a captured stone had their liberties changed
+    BitBoard<board_size> changed = captured;
+    changed.set(index);
+    BitBoard<board_size> to_update =
+        changed.neighbors() & (stones_[0] | stones_[1]);
+    while (!to_update.empty()) {
+      const int head = chain_head_[to_update.lowest()];
+      update_liberties_at_head_(head);
+      const BitBoard<board_size> chain = chain_mask_(head);
+      changed |= chain;
+      to_update &= ~chain;
+    }
+    chain_next_[index] = undo.placed_chain_[0];
+    chain_head_[index] = undo.placed_chain_[1];
+    chain_size_[index] = undo.placed_chain_[2];
+    liberties_[index] = undo.placed_chain_[3];
+    // the same points move() recomputed, now from the restored chains
+    update_legal_(changed);
+  }
+  turn_ = undo.turn_;
+  winner_ = undo.winner_;
+  hash_ = undo.hash_;
+  turns_ = undo.turns_;
+  passes_ = undo.passes_;
+  done_ = false;
+  num_hashes_ = undo.num_hashes_;
+  if (undo.filter_word_ >= 0) {
+    seen_filter_[undo.filter_word_] = undo.filter_bits_;
+  }
+  legal_actions_ready_ = false;
+}
+
+template <int board_size>
+size_t GameState<board_size>::hash() const { return hash_; }
+
+template <int board_size>
+size_t GameState<board_size>::history_hash(int num_boards) const {
+  assert(0 < num_boards && num_boards <= GAME_HISTORY_LEN);
+  size_t h = hash_;
+  for (int i = 1; i < num_boards; ++i) {
+    // multiply between boards so that the same boards in another order, or
+    // at another age, give a different hash
+    h = (h ^ board_hashes_[(head_ + i) % GAME_HISTORY_LEN]) *
+        0x9E3779B97F4A7C15ULL;
+  }
+  return h;
+}
+
+template <int board_size>
+size_t GameState<board_size>::compute_hash() const {
+  size_t h = 0;
+  for (int i = 0; i < board_size * board_size; ++i) {
+    Color c = boards_[head_][i / board_size][i % board_size];
+    if (c != EMPTY) {
+      h ^= zobrist_->get_value(stone_feature_(c, i));
+    }
+  }
+  if (turn_ == BLACK) {
+    h ^= zobrist_->get_value(board_size * board_size * 2);
+  }
+  return h;
+}
 
 // X = black, O = white, . = empty
-std::string GameState::to_string() const {
+template <int board_size>
+std::string GameState<board_size>::to_string() const {
   std::string str;
-  for (int x = 0; x < BOARD_SIZE; ++x) {
+  for (int x = 0; x < board_size; ++x) {
     str += '\n';
-    for (int y = 0; y < BOARD_SIZE; ++y) {
-      switch (boards_[0][x][y]) {
+    for (int y = 0; y < board_size; ++y) {
+      switch (boards_[head_][x][y]) {
       case BLACK: {
         str += 'X';
         break;
@@ -328,89 +395,234 @@ std::string GameState::to_string() const {
   return str;
 }
 
-void GameState::dfs_score_(int x, int y, Color opposite_color,
-                           bool reachable[][BOARD_SIZE]) const {
-  if (reachable[x][y]) {
-    return;
+// flood fill outwards from one color's stones, one ring of points per step;
+// every point enters the frontier at most once
+template <int board_size>
+BitBoard<board_size> GameState<board_size>::reachable_(int color_index) const {
+  const BitBoard<board_size> blocked = stones_[1 - color_index];
+  BitBoard<board_size> reachable = stones_[color_index];
+  BitBoard<board_size> frontier = reachable;
+  while (!frontier.empty()) {
+    frontier = frontier.neighbors() & ~(reachable | blocked);
+    reachable |= frontier;
+  }
+  return reachable;
+}
+
+template <int board_size>
+void GameState<board_size>::update_liberties_at_head_(int head) {
+  assert(chain_head_[head] == head);
+  liberties_[head] =
+      (chain_mask_(head).neighbors() & ~(stones_[0] | stones_[1])).count();
+}
+
+template <int board_size>
+BitBoard<board_size> GameState<board_size>::chain_mask_(int head) const {
+  BitBoard<board_size> mask;
+  int stone = head;
+  do {
+    mask.set(stone);
+    stone = chain_next_[stone];
+  } while (stone != head);
+  return mask;
+}
+
+template <int board_size>
+bool GameState<board_size>::is_legal_ignoring_repetition_(int x, int y,
+                                              Color color) const {
+  // action is legal if:
+  // 1. empty space
+  // 2. no chain of 4 stones
+  // 3. if not a capture, it cannot be a suicide
+  // repetition of a previous board is checked separately
+  // 1
+  if (boards_[head_][x][y] != EMPTY) {
+    return false;
   }
-  reachable[x][y] = true;
+  // 2
+  // ext_lib, capture and safe_chain are for checking 3) later
+  bool ext_lib = false;
+  bool capture = false;
+  bool safe_chain = false;
+  int chain_heads[4];
+  int num_heads = 0;
+  int stone_count = 0;
   for (const auto a : neighbors) {
-    if (0 <= a[0] + x && a[0] + x < BOARD_SIZE && 0 <= a[1] + y &&
-        a[1] + y < BOARD_SIZE &&
-        boards_[0][(a[0] + x)][a[1] + y] != opposite_color) {
-      dfs_score_(a[0] + x, a[1] + y, opposite_color, reachable);
+    if (0 <= a[0] + x && a[0] + x < board_size && 0 <= a[1] + y &&
+        a[1] + y < board_size) {
+      Color neighbor = boards_[head_][a[0] + x][a[1] + y];
+      if (neighbor == EMPTY) {
+        ext_lib = true;
+        continue;
+      }
+      const int head = chain_head_[(a[0] + x) * board_size + (a[1] + y)];
+      if (neighbor != color) {
+        capture |= liberties_[head] == 1;
+      } else if (std::find(chain_heads, chain_heads + num_heads, head) ==
+                 chain_heads + num_heads) {
+        chain_heads[num_heads++] = head;
+        stone_count += chain_size_[head];
+        assert(liberties_[head] >= 1);
+        safe_chain |= liberties_[head] > 1;
+      }
     }
   }
+  // adding a new stone to this would make a 4-chain
+  if (stone_count == 3) {
+    return false;
+  }
+  // 3
+  return ext_lib || capture || safe_chain;
 }
 
-void GameState::update_liberties_at_head_(int x, int y) {
-  assert(uf_find_(x, y) == std::make_pair(x, y));
-  std::set<std::pair<int, int>> lib_set;
-  for (const std::pair<int, int> &stone : chain_lists_[x][y]) {
-    int x0 = stone.first;
-    int y0 = stone.second;
-    for (const auto a : neighbors) {
-      if (0 <= a[0] + x0 && a[0] + x0 < BOARD_SIZE && 0 <= a[1] + y0 &&
-          a[1] + y0 < BOARD_SIZE && boards_[0][a[0] + x0][a[1] + y0] == EMPTY) {
-        lib_set.insert({a[0] + x0, a[1] + y0});
+template <int board_size>
+bool GameState<board_size>::repeats_history_(int x, int y) const {
+  // hash of the position after playing (x, y): our stone is added, any
+  // opponent chains in atari next to it are removed, and the turn passes
+  const int index = x * board_size + y;
+  size_t new_hash = hash_ ^ zobrist_->get_value(board_size * board_size * 2) ^
+                    zobrist_->get_value(stone_feature_(turn_, index));
+  const Color opposite_c = opposite(turn_);
+  int captured_heads[4];
+  int num_captured_heads = 0;
+  for (const auto a : neighbors) {
+    if (0 <= a[0] + x && a[0] + x < board_size && 0 <= a[1] + y &&
+        a[1] + y < board_size &&
+        boards_[head_][a[0] + x][a[1] + y] == opposite_c) {
+      const int head = chain_head_[(a[0] + x) * board_size + (a[1] + y)];
+      if (liberties_[head] != 1 ||
+          std::find(captured_heads, captured_heads + num_captured_heads,
+                    head) != captured_heads + num_captured_heads) {
+        continue;
       }
+      captured_heads[num_captured_heads++] = head;
+      int stone = head;
+      do {
+        new_hash ^= zobrist_->get_value(stone_feature_(opposite_c, stone));
+        stone = chain_next_[stone];
+      } while (stone != head);
+    }
+  }
+  if (seen_position_(new_hash)) {
+    return true;
+  }
+  // positional superko also forbids the same stones with the other side to
+  // move
+  return positional_superko_ &&
+         seen_position_(new_hash ^
+                        zobrist_->get_value(board_size * board_size * 2));
+}
+
+template <int board_size>
+bool GameState<board_size>::seen_position_(size_t position_hash) const {
+  const size_t bucket = position_hash % (SEEN_FILTER_WORDS * 64);
+  if (!((seen_filter_[bucket / 64] >> (bucket % 64)) & 1)) {
+    return false;
+  }
+  return std::find(hash_history_, hash_history_ + num_hashes_,
+                   position_hash) != hash_history_ + num_hashes_;
+}
+
+template <int board_size>
+void GameState<board_size>::record_position_() {
+  assert(num_hashes_ < MAX_GAME_LENGTH(board_size) + 1);
+  hash_history_[num_hashes_++] = hash_;
+  const size_t bucket = hash_ % (SEEN_FILTER_WORDS * 64);
+  seen_filter_[bucket / 64] |= uint64_t{1} << (bucket % 64);
+}
+
+template <int board_size>
+int GameState<board_size>::stone_feature_(Color color, int index) {
+  return (color == BLACK ? 0 : board_size * board_size) + index;
+}
+
+template <int board_size>
+void GameState<board_size>::update_legal_(const BitBoard<board_size> &changed) {
+  // legality of a point only depends on its neighbors and their chains, so
+  // only points next to a changed chain or a changed point can be affected
+  BitBoard<board_size> dirty = changed | changed.neighbors();
+  const BitBoard<board_size> occupied = stones_[0] | stones_[1];
+  legal_[0] &= ~(dirty & occupied);
+  legal_[1] &= ~(dirty & occupied);
+  dirty &= ~occupied;
+  while (!dirty.empty()) {
+    int index = dirty.pop_lowest();
+    int x = index / board_size;
+    int y = index % board_size;
+    if (is_legal_ignoring_repetition_(x, y, BLACK)) {
+      legal_[0].set(index);
+    } else {
+      legal_[0].reset(index);
+    }
+    if (is_legal_ignoring_repetition_(x, y, WHITE)) {
+      legal_[1].set(index);
+    } else {
+      legal_[1].reset(index);
     }
   }
-  liberties_[x][y] = static_cast<int>(lib_set.size());
 }
 
-void GameState::uf_make_(int x, int y) {
-  uf_chains_[x][y].first = x;
-  uf_chains_[x][y].second = y;
-  chain_lists_[x][y].emplace(std::make_pair(x, y));
+template <int board_size>
+void GameState<board_size>::list_legal_actions_() const {
+  legal_actions_ = legal_[turn_ == BLACK ? 0 : 1];
+  num_legal_actions_ = 0;
+  BitBoard<board_size> candidates = legal_actions_;
+  while (!candidates.empty()) {
+    int index = candidates.pop_lowest();
+    if (repeats_history_(index / board_size, index % board_size)) {
+      legal_actions_.reset(index);
+    } else {
+      legal_action_idxes_[num_legal_actions_++] = index;
+    }
+  }
+  legal_action_idxes_[num_legal_actions_++] = board_size * board_size;
+  legal_actions_ready_ = true;
 }
 
-std::pair<int, int> GameState::uf_find_(int x, int y) {
-  int parent_x = uf_chains_[x][y].first;
-  int parent_y = uf_chains_[x][y].second;
-  // path halving
-  while (parent_x != x || parent_y != y) {
-    uf_chains_[x][y] = uf_chains_[parent_x][parent_y];
-    x = parent_x;
-    y = parent_y;
-    parent_x = uf_chains_[x][y].first;
-    parent_y = uf_chains_[x][y].second;
-  }
-  return {x, y};
+template <int board_size>
+void GameState<board_size>::chain_make_(int index) {
+  chain_next_[index] = index;
+  chain_head_[index] = index;
+  chain_size_[index] = 1;
 }
 
-void GameState::uf_union_(int x1, int y1, int x2, int y2) {
-  std::pair<int, int> head_1 = uf_find_(x1, y1);
-  std::pair<int, int> head_2 = uf_find_(x2, y2);
+template <int board_size>
+int GameState<board_size>::chain_merge_(int index1, int index2) {
+  int head_1 = chain_head_[index1];
+  int head_2 = chain_head_[index2];
   if (head_1 == head_2) {
     // no merging needed here
-    return;
+    return -1;
   }
   // larger chain retains its head
-  if (chain_lists_[head_1.first][head_1.second].size() >=
-      chain_lists_[head_2.first][head_2.second].size()) {
-    uf_chains_[head_2.first][head_2.second] = head_1;
-    chain_lists_[head_1.first][head_1.second].insert(
-        chain_lists_[head_2.first][head_2.second].begin(),
-        chain_lists_[head_2.first][head_2.second].end());
-    chain_lists_[head_2.first][head_2.second].clear();
-    liberties_[head_2.first][head_2.second] = 0;
-  } else {
-    uf_chains_[head_1.first][head_1.second] = head_2;
-    chain_lists_[head_2.first][head_2.second].insert(
-        chain_lists_[head_1.first][head_1.second].begin(),
-        chain_lists_[head_1.first][head_1.second].end());
-    chain_lists_[head_1.first][head_1.second].clear();
-    liberties_[head_1.first][head_1.second] = 0;
+  if (chain_size_[head_1] < chain_size_[head_2]) {
+    std::swap(head_1, head_2);
   }
+  int stone = head_2;
+  do {
+    chain_head_[stone] = head_1;
+    stone = chain_next_[stone];
+  } while (stone != head_2);
+  // splice the two circular lists together
+  std::swap(chain_next_[head_1], chain_next_[head_2]);
+  chain_size_[head_1] += chain_size_[head_2];
+  return head_2;
 }
 
-void GameState::uf_delete_(int x1, int y1) {
-  std::pair<int, int> head = uf_find_(x1, y1);
-  for (const std::pair<int, int> &x : chain_lists_[head.first][head.second]) {
-    uf_chains_[x.first][x.second] = {-1, -1};
-  }
-  chain_lists_[head.first][head.second].clear();
+template <int board_size>
+void GameState<board_size>::chain_split_(int head_1, int head_2) {
+  // splicing is its own inverse
+  std::swap(chain_next_[head_1], chain_next_[head_2]);
+  int stone = head_2;
+  do {
+    chain_head_[stone] = head_2;
+    stone = chain_next_[stone];
+  } while (stone != head_2);
+  chain_size_[head_1] -= chain_size_[head_2];
 }
 
+template class GameState<9>;
+template class GameState<13>;
+template class GameState<19>;
+
 } // namespace game
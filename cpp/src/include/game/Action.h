@@ -11,9 +11,9 @@ namespace game {
 
 enum ActionType { PLAY, PASS, RESIGN };
 
-class Action {
+template <int board_size> class Action {
 public:
-  // action indexes go from 0 to BOARD_SIZE * BOARD_SIZE + 1
+  // action indexes go from 0 to board_size * board_size + 1
   Action(Color color, int index);
   Action(Color color, ActionType action_type, int x = 0, int y = 0);
   [[nodiscard]] Color get_color() const;
@@ -29,9 +29,9 @@ public:
 
 private:
   /* Each action is internally represented by a single integer from 1 to
-   * BOARD_SIZE^2 + 2, plus positive for Black and negative for White moves.
-   * Moves 1 to BOARD_SIZE^2 represent playing; BOARD_SIZE^2 + 1 is passing;
-   * BOARD_SIZE^2 + 2 is resigning. */
+   * board_size^2 + 2, plus positive for Black and negative for White moves.
+   * Moves 1 to board_size^2 represent playing; board_size^2 + 1 is passing;
+   * board_size^2 + 2 is resigning. */
   int value_;
 };
 
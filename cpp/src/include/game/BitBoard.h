@@ -0,0 +1,187 @@
+//
+// Created by Jeremy on 2/6/2022.
+//
+
+#ifndef ROOST_BITBOARD_H
+#define ROOST_BITBOARD_H
+
+#include "game_defs.h"
+#include <cstdint>
+
+namespace game {
+
+/* A set of board points stored as one bit per point. Bit i corresponds to
+ * action index i, i.e. point (i / board_size, i % board_size). Bits past the
+ * last point are always kept at 0. */
+template <int board_size> class BitBoard {
+  // number of 64-bit words needed to hold one bit per board point
+  static constexpr int BITBOARD_WORDS = (board_size * board_size + 63) / 64;
+
+public:
+  constexpr BitBoard() : words_{} {}
+
+  static constexpr BitBoard single(int index) {
+    BitBoard b;
+    b.set(index);
+    return b;
+  }
+  // every point on the board
+  static constexpr BitBoard full() {
+    BitBoard b;
+    for (int i = 0; i < board_size * board_size; ++i) {
+      b.set(i);
+    }
+    return b;
+  }
+
+  [[nodiscard]] constexpr bool test(int index) const {
+    return (words_[index >> 6] >> (index & 63)) & 1;
+  }
+  constexpr void set(int index) {
+    words_[index >> 6] |= uint64_t{1} << (index & 63);
+  }
+  constexpr void reset(int index) {
+    words_[index >> 6] &= ~(uint64_t{1} << (index & 63));
+  }
+  [[nodiscard]] constexpr bool empty() const {
+    for (uint64_t w : words_) {
+      if (w != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+  [[nodiscard]] int count() const {
+    int c = 0;
+    for (uint64_t w : words_) {
+      c += __builtin_popcountll(w);
+    }
+    return c;
+  }
+  // index of the lowest set point; undefined if empty
+  [[nodiscard]] int lowest() const {
+    for (int i = 0; i < BITBOARD_WORDS; ++i) {
+      if (words_[i] != 0) {
+        return i * 64 + __builtin_ctzll(words_[i]);
+      }
+    }
+    return -1;
+  }
+  // removes the lowest set point and returns its index; undefined if empty
+  int pop_lowest() {
+    for (int i = 0; i < BITBOARD_WORDS; ++i) {
+      if (words_[i] != 0) {
+        int index = i * 64 + __builtin_ctzll(words_[i]);
+        words_[i] &= words_[i] - 1;
+        return index;
+      }
+    }
+    return -1;
+  }
+
+  // all points orthogonally adjacent to at least one set point; set points
+  // are only included if they neighbor another set point
+  [[nodiscard]] constexpr BitBoard neighbors() const {
+    BitBoard ret = shifted_(1) & NOT_FIRST_COLUMN;
+    ret |= shifted_(-1) & NOT_LAST_COLUMN;
+    ret |= shifted_(board_size);
+    ret |= shifted_(-board_size);
+    return ret & FULL;
+  }
+
+  constexpr BitBoard operator&(const BitBoard &other) const {
+    BitBoard b = *this;
+    b &= other;
+    return b;
+  }
+  constexpr BitBoard operator|(const BitBoard &other) const {
+    BitBoard b = *this;
+    b |= other;
+    return b;
+  }
+  constexpr BitBoard operator^(const BitBoard &other) const {
+    BitBoard b = *this;
+    b ^= other;
+    return b;
+  }
+  // complement restricted to on-board points
+  constexpr BitBoard operator~() const {
+    BitBoard b;
+    for (int i = 0; i < BITBOARD_WORDS; ++i) {
+      b.words_[i] = ~words_[i] & FULL.words_[i];
+    }
+    return b;
+  }
+  constexpr BitBoard &operator&=(const BitBoard &other) {
+    for (int i = 0; i < BITBOARD_WORDS; ++i) {
+      words_[i] &= other.words_[i];
+    }
+    return *this;
+  }
+  constexpr BitBoard &operator|=(const BitBoard &other) {
+    for (int i = 0; i < BITBOARD_WORDS; ++i) {
+      words_[i] |= other.words_[i];
+    }
+    return *this;
+  }
+  constexpr BitBoard &operator^=(const BitBoard &other) {
+    for (int i = 0; i < BITBOARD_WORDS; ++i) {
+      words_[i] ^= other.words_[i];
+    }
+    return *this;
+  }
+  constexpr bool operator==(const BitBoard &other) const = default;
+
+private:
+  static const BitBoard FULL;
+  static const BitBoard NOT_FIRST_COLUMN;
+  static const BitBoard NOT_LAST_COLUMN;
+
+  static constexpr BitBoard column_mask_(int skip_column) {
+    BitBoard b;
+    for (int i = 0; i < board_size * board_size; ++i) {
+      if (i % board_size != skip_column) {
+        b.set(i);
+      }
+    }
+    return b;
+  }
+  // moves every bit n indexes higher (n > 0) or lower (n < 0); bits shifted
+  // past the last word are dropped but NOT masked to the board
+  [[nodiscard]] constexpr BitBoard shifted_(int n) const {
+    BitBoard b;
+    if (n > 0) {
+      for (int i = BITBOARD_WORDS - 1; i >= 0; --i) {
+        b.words_[i] = words_[i] << n;
+        if (i > 0) {
+          b.words_[i] |= words_[i - 1] >> (64 - n);
+        }
+      }
+    } else {
+      n = -n;
+      for (int i = 0; i < BITBOARD_WORDS; ++i) {
+        b.words_[i] = words_[i] >> n;
+        if (i + 1 < BITBOARD_WORDS) {
+          b.words_[i] |= words_[i + 1] << (64 - n);
+        }
+      }
+    }
+    return b;
+  }
+
+  uint64_t words_[BITBOARD_WORDS];
+};
+
+template <int board_size>
+inline constexpr BitBoard<board_size> BitBoard<board_size>::FULL =
+    BitBoard<board_size>::full();
+template <int board_size>
+inline constexpr BitBoard<board_size> BitBoard<board_size>::NOT_FIRST_COLUMN =
+    column_mask_(0);
+template <int board_size>
+inline constexpr BitBoard<board_size> BitBoard<board_size>::NOT_LAST_COLUMN =
+    column_mask_(board_size - 1);
+
+} // namespace game
+
+#endif // ROOST_BITBOARD_H
@@ -6,24 +6,71 @@
 #define ROOST_GAMESTATE_H
 
 #include "Action.h"
+#include "BitBoard.h"
 #include "game_defs.h"
 #include "utils/Zobrist.h"
-#include <memory>
-#include <set>
+#include <algorithm>
+#include <cstdint>
+#include <span>
 #include <string>
-#include <vector>
+#include <type_traits>
 
 namespace game {
 
-class GameState {
+/* The board size is a template parameter so that every loop bound and array
+ * size is a compile-time constant. Supported sizes are explicitly
+ * instantiated in GameState.cpp. */
+template <int board_size> class GameState {
 public:
-  explicit GameState(float komi = 7.5,
-                     const std::shared_ptr<Zobrist> &zobrist = nullptr);
+  // zobrist must outlive the state and every copy of it; if null, a
+  // process-wide table is used. moves that recreate an earlier position with
+  // the same side to move are illegal (situational superko); with
+  // positional_superko, recreating an earlier position is illegal regardless
+  // of the side to move
+  explicit GameState(float komi = 7.5, const Zobrist *zobrist = nullptr,
+                     bool positional_superko = false);
+  // what undo_move needs to take back one move, filled in by move: the point
+  // played, the stones it captured, the history board it wrote over, the
+  // chain merges and the scalars. stones, chains, liberties and legality
+  // around the move are rebuilt from these
+  class Undo {
+  private:
+    friend class GameState;
+    Color turn_;
+    Color winner_;
+    size_t hash_;
+    unsigned turns_;
+    unsigned passes_;
+    int head_;
+    int num_hashes_;
+    // the seen_filter_ word the move set a bit in and its old value, or -1
+    int filter_word_;
+    uint64_t filter_bits_;
+    // the rest is only set for plays
+    bool play_;
+    int placed_;
+    BitBoard<board_size> captured_;
+    Color evicted_board_[board_size][board_size];
+    size_t evicted_hash_;
+    // {kept head, merged head} of each chain_merge_, in order
+    int merges_[4][2];
+    int num_merges_;
+    // chain_next_, chain_head_, chain_size_ and liberties_ of the point
+    // played. they are stale, but may still be the links of a chain that an
+    // earlier move captured and that undo_move will bring back
+    int placed_chain_[4];
+  };
   // int operator==(const GameState &other);
 
   // gets the turn; undefined behavior if game is done
   [[nodiscard]] Color get_turn() const;
   [[nodiscard]] int get_num_turns() const;
+  // passes in a row at the end of the game so far; two end the game
+  [[nodiscard]] int get_passes() const;
+  // boards are returned newest first: get_board(0) is the current board and
+  // get_board(i) is the board i plays ago (empty before the game started).
+  // each is board_size * board_size colors in row-major order, and
+  // 0 <= i < GAME_HISTORY_LEN
   [[nodiscard]] const Color *get_board(int i) const;
   // gets the komi
   [[nodiscard]] float get_komi() const;
@@ -34,18 +81,40 @@ public:
   // returns current score if game were to finish at moment - valid both
   // before/after game is finished
   [[nodiscard]] float score() const;
-  // always returns false if the game is done
-  [[nodiscard]] bool is_legal_action(Action action) const;
-  // returns empty vector if the game is done; otherwise, there is always >=1
-  // legal move (pass) does NOT include resign, which is always legal
-  [[nodiscard]] const std::vector<int> *get_legal_action_indexes() const;
-  void move(Action action);
+  // writes who owns each of the board_size * board_size points under area
+  // scoring, in the same order as get_board: BLACK or WHITE if only that
+  // color's stones can reach the point, otherwise EMPTY
+  void get_ownership(Color *ownership) const;
+  // always returns false if the game is done. checks only this action
+  // unless the legal actions were already listed
+  [[nodiscard]] bool is_legal_action(Action<board_size> action) const;
+  // returns empty span if the game is done; otherwise, there is always >=1
+  // legal move (pass) does NOT include resign, which is always legal. the
+  // list is made on the first call after a move, and is only valid until
+  // the next move
+  [[nodiscard]] std::span<const int> get_legal_action_indexes() const;
+  // if undo is not null, it records how to take the move back
+  void move(Action<board_size> action, Undo *undo = nullptr);
+  // takes back the last move, which was played with move(action, &undo);
+  // moves are taken back newest first. this is much cheaper than copying
+  // the state before the move
+  void undo_move(const Undo &undo);
   [[nodiscard]] size_t hash() const;
+  // hash of the turn and of boards get_board(0) to get_board(num_boards - 1),
+  // i.e. of everything a network given num_boards boards of history sees
+  [[nodiscard]] size_t history_hash(int num_boards) const;
+  // recomputes hash() from the board and turn; hash() is maintained
+  // incrementally and must always match this. building with
+  // ROOST_VERIFY_HASH checks this after every move
+  [[nodiscard]] size_t compute_hash() const;
   [[nodiscard]] std::string to_string() const;
 
 private:
-  // boards[0] is the most recent board, then boards[1], etc.
-  Color boards_[GAME_HISTORY_LEN][BOARD_SIZE][BOARD_SIZE];
+  // ring buffer of boards: boards_[head_] is the most recent board, then
+  // boards_[(head_ + 1) % GAME_HISTORY_LEN], etc.
+  Color boards_[GAME_HISTORY_LEN][board_size][board_size];
+  // zobrist hash of the stones on each board of the ring, without the turn
+  size_t board_hashes_[GAME_HISTORY_LEN];
   Color turn_;
   Color winner_;
   float komi_;
@@ -53,36 +122,81 @@ private:
   unsigned turns_;
   unsigned passes_;
   bool done_;
-  std::pair<int, int> uf_chains_[BOARD_SIZE][BOARD_SIZE];
-  std::set<std::pair<int, int>> chain_lists_[BOARD_SIZE][BOARD_SIZE];
-  int liberties_[BOARD_SIZE][BOARD_SIZE];
-  // this is valid UNLESS done_ = true
-  std::vector<int> legal_action_idxes_;
-  std::shared_ptr<Zobrist> zobrist_;
-  void dfs_score_(int x, int y, Color opposite_color,
-                  bool reachable[][BOARD_SIZE]) const;
-  void update_liberties_at_head_(int x, int y);
-  void uf_make_(int x, int y);
-  std::pair<int, int> uf_find_(int x, int y);
-  void uf_union_(int x1, int y1, int x2, int y2);
-  void uf_delete_(int x1, int y1);
+  int head_;
+  // stones of each color on boards_[head_]; index 0 is black, 1 is white
+  BitBoard<board_size> stones_[2];
+  // points where each color could play ignoring repetition: empty, no
+  // 4-chain, and not suicide. kept up to date incrementally by move()
+  BitBoard<board_size> legal_[2];
+  // chains are circular linked lists of stones through chain_next_, indexed
+  // by x * board_size + y. every stone stores its chain's head, and only the
+  // head's entries in chain_size_ and liberties_ are valid. entries for empty
+  // points are stale and must not be read
+  using Point =
+      std::conditional_t<board_size * board_size <= 256, uint8_t, uint16_t>;
+  Point chain_next_[board_size * board_size];
+  Point chain_head_[board_size * board_size];
+  Point chain_size_[board_size * board_size];
+  Point liberties_[board_size * board_size];
+  // legal points for the side to move, repetition included, and the same
+  // plus pass as action indexes. only valid if legal_actions_ready_ and not
+  // done_; get_legal_action_indexes() makes them when they are first needed
+  mutable BitBoard<board_size> legal_actions_;
+  mutable int legal_action_idxes_[board_size * board_size + 1];
+  mutable int num_legal_actions_;
+  mutable bool legal_actions_ready_;
+  // hash_ of every position so far this game, for superko. seen_filter_ has
+  // one bit per hash bucket, so most lookups never scan hash_history_
+  static constexpr int SEEN_FILTER_WORDS = 16;
+  size_t hash_history_[MAX_GAME_LENGTH(board_size) + 1];
+  int num_hashes_;
+  uint64_t seen_filter_[SEEN_FILTER_WORDS];
+  bool positional_superko_;
+  const Zobrist *zobrist_;
+  // points connected to stones of stones_[color_index] without crossing
+  // the other color's stones, including those stones themselves
+  [[nodiscard]] BitBoard<board_size> reachable_(int color_index) const;
+  void update_liberties_at_head_(int head);
+  [[nodiscard]] BitBoard<board_size> chain_mask_(int head) const;
+  [[nodiscard]] bool is_legal_ignoring_repetition_(int x, int y,
+                                                   Color color) const;
+  [[nodiscard]] bool repeats_history_(int x, int y) const;
+  [[nodiscard]] bool seen_position_(size_t position_hash) const;
+  void record_position_();
+  // index of the Zobrist feature for a stone of color at index
+  static int stone_feature_(Color color, int index);
+  void update_legal_(const BitBoard<board_size> &changed);
+  void list_legal_actions_() const;
+  void chain_make_(int index);
+  // returns the head of the chain that joined the other one, or -1 if the
+  // stones were already in one chain
+  int chain_merge_(int index1, int index2);
+  // undoes chain_merge_, given the head that was kept and the one returned
+  void chain_split_(int head_1, int head_2);
 };
 
+// states are copied for every leaf a search evaluates in a batch, so they
+// must stay cheap to copy: no heap-owning members
+static_assert(std::is_trivially_copyable_v<GameState<DEFAULT_BOARD_SIZE>>);
+
 } // namespace game
 
 // Implement std::hash on GameState
 // perhaps this could be improved
-template <> struct std::hash<game::GameState> {
-  std::size_t operator()(const game::GameState &g) const { return g.hash(); }
+template <int board_size> struct std::hash<game::GameState<board_size>> {
+  std::size_t operator()(const game::GameState<board_size> &g) const {
+    return g.hash();
+  }
 };
 
 // TODO: figure out why I couldn't just overload operator== here and fix into a
 // real equal_to
-template <> struct std::equal_to<game::GameState> {
-  bool operator()(const game::GameState &lhs,
-                  const game::GameState &rhs) const {
-    return lhs.hash() == rhs.hash() && *(lhs.get_legal_action_indexes()) ==
-                                           *(rhs.get_legal_action_indexes());
+template <int board_size> struct std::equal_to<game::GameState<board_size>> {
+  bool operator()(const game::GameState<board_size> &lhs,
+                  const game::GameState<board_size> &rhs) const {
+    return lhs.hash() == rhs.hash() &&
+           std::ranges::equal(lhs.get_legal_action_indexes(),
+                              rhs.get_legal_action_indexes());
   }
 };
 
@@ -0,0 +1,78 @@
+//
+// Created by Jeremy on 2/27/2022.
+//
+
+#ifndef ROOST_SYMMETRY_H
+#define ROOST_SYMMETRY_H
+
+#include <array>
+#include <cstdint>
+
+#define NUM_SYMMETRIES 8
+
+namespace game {
+
+/* The 8 symmetries of the board (the dihedral group of the square). Symmetry
+ * s transposes the board if s & 4, then mirrors it top to bottom if s & 1 and
+ * left to right if s & 2; symmetry 0 is the identity. Tables are indexed by
+ * action index, and the pass index board_size * board_size maps to itself. */
+template <int board_size> class Symmetry {
+  static constexpr int NUM_INDEXES = board_size * board_size + 1;
+
+public:
+  using Table = std::array<int16_t, NUM_INDEXES>;
+
+  // forward(s)[i] is the index that index i moves to under symmetry s
+  static const Table &forward(int s) { return FORWARD[s]; }
+  // inverse(s)[i] is the index that moves to index i under symmetry s
+  static const Table &inverse(int s) { return INVERSE[s]; }
+
+private:
+  static const std::array<Table, NUM_SYMMETRIES> FORWARD;
+  static const std::array<Table, NUM_SYMMETRIES> INVERSE;
+
+  static constexpr std::array<Table, NUM_SYMMETRIES> make_forward_() {
+    std::array<Table, NUM_SYMMETRIES> tables{};
+    for (int s = 0; s < NUM_SYMMETRIES; ++s) {
+      for (int x = 0; x < board_size; ++x) {
+        for (int y = 0; y < board_size; ++y) {
+          int new_x = (s & 4) ? y : x;
+          int new_y = (s & 4) ? x : y;
+          if (s & 1) {
+            new_x = board_size - 1 - new_x;
+          }
+          if (s & 2) {
+            new_y = board_size - 1 - new_y;
+          }
+          tables[s][x * board_size + y] =
+              static_cast<int16_t>(new_x * board_size + new_y);
+        }
+      }
+      tables[s][NUM_INDEXES - 1] = NUM_INDEXES - 1;
+    }
+    return tables;
+  }
+  static constexpr std::array<Table, NUM_SYMMETRIES> make_inverse_() {
+    const std::array<Table, NUM_SYMMETRIES> forward = make_forward_();
+    std::array<Table, NUM_SYMMETRIES> tables{};
+    for (int s = 0; s < NUM_SYMMETRIES; ++s) {
+      for (int i = 0; i < NUM_INDEXES; ++i) {
+        tables[s][forward[s][i]] = static_cast<int16_t>(i);
+      }
+    }
+    return tables;
+  }
+};
+
+template <int board_size>
+inline constexpr std::array<typename Symmetry<board_size>::Table,
+                            NUM_SYMMETRIES>
+    Symmetry<board_size>::FORWARD = make_forward_();
+template <int board_size>
+inline constexpr std::array<typename Symmetry<board_size>::Table,
+                            NUM_SYMMETRIES>
+    Symmetry<board_size>::INVERSE = make_inverse_();
+
+} // namespace game
+
+#endif // ROOST_SYMMETRY_H
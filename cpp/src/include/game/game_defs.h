@@ -5,16 +5,18 @@
 #ifndef ROOST_GAME_DEFS_H
 #define ROOST_GAME_DEFS_H
 
+#include <cstdint>
 #include <stdexcept>
-#define BOARD_SIZE 9
+#define DEFAULT_BOARD_SIZE 9
 #define GAME_HISTORY_LEN 8
-#define MAX_GAME_LENGTH (2 * BOARD_SIZE * BOARD_SIZE + 1)
+#define MAX_GAME_LENGTH(board_size) (2 * (board_size) * (board_size) + 1)
 
 namespace game {
 
 // this allows us to quickly set empty boards via memset()
 constexpr int neighbors[4][2] = {{-1, 0}, {1, 0}, {0, 1}, {0, -1}};
-enum Color { EMPTY = 0, BLACK = 1, WHITE = -1 };
+// one byte per point keeps each history board in GameState small to copy
+enum Color : int8_t { EMPTY = 0, BLACK = 1, WHITE = -1 };
 inline Color opposite(const Color &c) {
   if (c == BLACK)
     return WHITE;
@@ -4,16 +4,23 @@
 
 #ifndef ROOST_GTP_H
 #define ROOST_GTP_H
+#include "play/TimeControl.h"
 #include "player/AbstractPlayer.h"
 #include <memory>
 
-class GTP {
+template <int board_size> class GTP {
 public:
-  explicit GTP(std::shared_ptr<AbstractPlayer> engine);
+  // with ponder, the engine keeps thinking about the current position while
+  // waiting for each command. once the controller sends time settings, each
+  // genmove gets a time budget from the clock
+  explicit GTP(std::shared_ptr<AbstractPlayer<board_size>> engine,
+               bool ponder = false);
   void run();
 
 private:
-  std::shared_ptr<AbstractPlayer> engine_;
+  std::shared_ptr<AbstractPlayer<board_size>> engine_;
+  bool ponder_;
+  TimeControl<board_size> time_control_;
 };
 
 #endif // ROOST_GTP_H
@@ -15,16 +15,16 @@
 #include <random>
 #include <string>
 
-class Match {
+template <int board_size> class Match {
 public:
-  Match(std::shared_ptr<AbstractPlayer> black,
-        std::shared_ptr<AbstractPlayer> white);
+  Match(std::shared_ptr<AbstractPlayer<board_size>> black,
+        std::shared_ptr<AbstractPlayer<board_size>> white);
   // returns number of games won by black
   float run(int gameId);
 
 private:
   // TODO: investigate unique_ptr memory leak
-  std::shared_ptr<AbstractPlayer> players[2];
+  std::shared_ptr<AbstractPlayer<board_size>> players[2];
   std::random_device rd_;
   std::mt19937 gen_;
   // std::string save_dir_;
@@ -0,0 +1,80 @@
+//
+// Created by Jeremy on 3/13/2022.
+//
+
+#ifndef ROOST_TIMECONTROL_H
+#define ROOST_TIMECONTROL_H
+
+#include "game/game_defs.h"
+
+// seconds kept back from every move for network lag and overhead
+#define TIME_LAG_SECONDS 0.5
+// shortest time given to a move, unless less than that is left
+#define TIME_MIN_MOVE_SECONDS 0.1
+// fewest of our own moves assumed to be left in the game
+#define TIME_MIN_MOVES_LEFT 15
+// expected length of a game, in moves by both sides
+#define TIME_EXPECTED_GAME_LENGTH(board_size)                                  \
+  ((board_size) * (board_size) * 7 / 10)
+// share of the even split spent on an opening move, where the network's
+// policy alone is usually good enough
+#define TIME_OPENING_FACTOR 0.5
+// share of each byo-yomi period's time per move that is used
+#define TIME_BYO_YOMI_FACTOR 0.8
+
+/* The clocks of both sides under GTP time settings, and how long to think
+ * about a move. Time after main_time comes in byo-yomi periods: canadian
+ * periods of byo_yomi_time seconds for byo_yomi_stones moves (GTP
+ * time_settings), or japanese periods of byo_yomi_time seconds for one move
+ * each, byo_yomi_periods of them (kgs-time_settings byoyomi).
+ *
+ * A move gets an even share of main time over the moves we expect to have
+ * left, less in the opening, plus what byo-yomi safely allows per move. When
+ * the controller doesn't send time_left, spend() keeps the clocks. */
+template <int board_size> class TimeControl {
+public:
+  // no time limit until set_time_settings is called
+  TimeControl();
+  // GTP time_settings, i.e. canadian byo-yomi. byo_yomi_time > 0 with
+  // byo_yomi_stones == 0, or all zero, means no time limit, as in GTP
+  void set_time_settings(double main_time, double byo_yomi_time,
+                         int byo_yomi_stones);
+  // japanese byo-yomi
+  void set_byo_yomi_periods(double main_time, double period_time,
+                            int periods);
+  void set_unlimited();
+  // GTP time_left: stones is 0 in main time; in byo-yomi it is the stones
+  // left in the canadian period, or the periods left if japanese
+  void set_time_left(game::Color color, double time, int stones);
+  // restores both clocks to the settings, e.g. for a new game
+  void reset_clocks();
+  // takes seconds spent on a move by color off its clock
+  void spend(game::Color color, double seconds);
+  [[nodiscard]] bool is_limited() const;
+  // seconds color should think about the move_num-th move of the game
+  // (counting both sides' moves from 0); only valid if is_limited()
+  [[nodiscard]] double allocate(game::Color color, int move_num) const;
+
+private:
+  class Clock {
+  public:
+    double main_left;
+    // seconds left in the current byo-yomi period, once main time is over
+    double period_left;
+    // moves still to play in the current canadian period
+    int stones_left;
+    // japanese periods left, including the current one
+    int periods_left;
+  };
+  static int color_index_(game::Color color);
+  bool limited_;
+  bool japanese_;
+  double main_time_;
+  double byo_yomi_time_;
+  int byo_yomi_stones_;
+  int byo_yomi_periods_;
+  // index 0 is black, 1 is white
+  Clock clocks_[2];
+};
+
+#endif // ROOST_TIMECONTROL_H
@@ -10,15 +10,27 @@
 #include "../game/Action.h"
 #include "../game/GameState.h"
 
-class AbstractPlayer {
+template <int board_size> class AbstractPlayer {
 public:
   explicit AbstractPlayer() {}
-  virtual float get_wr(game::GameState state) { return 0.0f; }
+  virtual float get_wr(game::GameState<board_size> state) { return 0.0f; }
   virtual double get_eval_time() { return 0.0; }
-  virtual game::Action get_move(game::GameState state, std::string *log) {
+  virtual game::Action<board_size> get_move(game::GameState<board_size> state,
+                                            std::string *log) {
     return get_move(std::move(state));
   }
-  virtual game::Action get_move(game::GameState state) = 0;
+  virtual game::Action<board_size>
+  get_move(game::GameState<board_size> state) = 0;
+  // called with every move of the current game, by either side, once it has
+  // been played, so that players can carry work over to the next position
+  virtual void play(game::Action<board_size> /*action*/) {}
+  // starts thinking about state in the background, e.g. on the opponent's
+  // time, until stop_pondering() or any other call
+  virtual void ponder(game::GameState<board_size> /*state*/) {}
+  virtual void stop_pondering() {}
+  // limits each following get_move to about seconds of thinking; 0 lifts the
+  // limit
+  virtual void set_time_budget(double /*seconds*/) {}
   virtual void reset() {}
 };
 
@@ -0,0 +1,206 @@
+//
+// Created by Jeremy on 3/6/2022.
+//
+
+#ifndef ROOST_CACHINGEVALUATOR_H
+#define ROOST_CACHINGEVALUATOR_H
+
+#include "Evaluator.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define NN_CACHE_DEFAULT_ENTRIES (1 << 16)
+// number of locks shared by the entries; entry i is guarded by lock
+// i % NN_CACHE_STRIPES
+#define NN_CACHE_STRIPES 64
+
+/* A fixed-size table of evaluations in front of another evaluator, shared by
+ * every thread that evaluates through it, so that positions reached by
+ * several games (e.g. every opening) or again later in a search skip the
+ * network. Entries are keyed by GameState::history_hash over the boards the
+ * network sees; a position maps to one slot, and a newer position replaces
+ * whatever was there.
+ *
+ * Policies and values are stored as 16-bit fixed point, which halves an
+ * entry and loses under 1e-4 of precision. Evaluations of finished games are
+ * never cached. */
+template <int board_size> class CachingEvaluator : public Evaluator<board_size> {
+public:
+  using Evaluation = typename Evaluator<board_size>::Evaluation;
+  // counters since construction
+  class CacheStats {
+  public:
+    uint64_t lookups_;
+    uint64_t hits_;
+    [[nodiscard]] std::string to_string() const;
+  };
+
+  // num_entries is rounded up to a power of 2. history_len must be the
+  // number of history boards evaluator's input depends on
+  CachingEvaluator(std::shared_ptr<Evaluator<board_size>> evaluator,
+                   size_t num_entries = NN_CACHE_DEFAULT_ENTRIES,
+                   int history_len = GAME_HISTORY_LEN);
+  Evaluation Evaluate(const game::GameState<board_size> &state) override;
+  // passes only the states that miss on to the wrapped evaluator, as one
+  // batch
+  void
+  EvaluateBatch(const std::vector<const game::GameState<board_size> *> &states,
+                Evaluation *evaluations) override;
+  // may be called from any thread while evaluations are running
+  [[nodiscard]] CacheStats get_cache_stats() const;
+
+private:
+  static constexpr int POLICY_SIZE = board_size * board_size + 1;
+  class Entry {
+  public:
+    // 0 marks an empty entry; a state whose key is 0 is never cached
+    uint64_t key;
+    uint16_t policy[POLICY_SIZE];
+    int16_t value;
+  };
+  [[nodiscard]] uint64_t key_(const game::GameState<board_size> &state) const;
+  // copies the entry for key to evaluation and returns true if there is one
+  bool lookup_(uint64_t key, Evaluation *evaluation);
+  void store_(uint64_t key, const Evaluation &evaluation);
+  std::shared_ptr<Evaluator<board_size>> evaluator_;
+  const int history_len_;
+  size_t mask_;
+  std::unique_ptr<Entry[]> entries_;
+  std::mutex locks_[NN_CACHE_STRIPES];
+  std::atomic<uint64_t> lookups_;
+  std::atomic<uint64_t> hits_;
+};
+
+template <int board_size>
+CachingEvaluator<board_size>::CachingEvaluator(
+    std::shared_ptr<Evaluator<board_size>> evaluator, size_t num_entries,
+    int history_len)
+    : evaluator_(std::move(evaluator)), history_len_(history_len),
+      lookups_(0), hits_(0) {
+  size_t size = 1;
+  while (size < num_entries) {
+    size *= 2;
+  }
+  mask_ = size - 1;
+  entries_.reset(new Entry[size]);
+  for (size_t i = 0; i < size; ++i) {
+    entries_[i].key = 0;
+  }
+}
+
+template <int board_size>
+typename Evaluator<board_size>::Evaluation
+CachingEvaluator<board_size>::Evaluate(
+    const game::GameState<board_size> &state) {
+  if (state.done()) {
+    return evaluator_->Evaluate(state);
+  }
+  Evaluation evaluation;
+  const uint64_t key = key_(state);
+  if (lookup_(key, &evaluation)) {
+    return evaluation;
+  }
+  evaluation = evaluator_->Evaluate(state);
+  store_(key, evaluation);
+  return evaluation;
+}
+
+template <int board_size>
+void CachingEvaluator<board_size>::EvaluateBatch(
+    const std::vector<const game::GameState<board_size> *> &states,
+    Evaluation *evaluations) {
+  // reused across calls so that a search does not allocate per batch
+  thread_local std::vector<const game::GameState<board_size> *> misses;
+  thread_local std::vector<size_t> miss_indexes;
+  thread_local std::vector<Evaluation> miss_evaluations;
+  misses.clear();
+  miss_indexes.clear();
+  for (size_t i = 0; i < states.size(); ++i) {
+    if (!lookup_(key_(*states[i]), &evaluations[i])) {
+      misses.push_back(states[i]);
+      miss_indexes.push_back(i);
+    }
+  }
+  if (misses.empty()) {
+    return;
+  }
+  miss_evaluations.resize(std::max(miss_evaluations.size(), misses.size()));
+  evaluator_->EvaluateBatch(misses, miss_evaluations.data());
+  for (size_t i = 0; i < misses.size(); ++i) {
+    evaluations[miss_indexes[i]] = miss_evaluations[i];
+    store_(key_(*misses[i]), miss_evaluations[i]);
+  }
+}
+
+template <int board_size>
+uint64_t CachingEvaluator<board_size>::key_(
+    const game::GameState<board_size> &state) const {
+  return state.history_hash(history_len_);
+}
+
+template <int board_size>
+bool CachingEvaluator<board_size>::lookup_(uint64_t key,
+                                           Evaluation *evaluation) {
+  lookups_.fetch_add(1, std::memory_order_relaxed);
+  if (key == 0) {
+    return false;
+  }
+  const size_t index = key & mask_;
+  const Entry &entry = entries_[index];
+  {
+    std::lock_guard<std::mutex> lock(locks_[index % NN_CACHE_STRIPES]);
+    if (entry.key != key) {
+      return false;
+    }
+    for (int i = 0; i < POLICY_SIZE; ++i) {
+      evaluation->policy_[i] = entry.policy[i] * (1.0f / UINT16_MAX);
+    }
+    evaluation->value_ = entry.value * (1.0f / INT16_MAX);
+  }
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+template <int board_size>
+void CachingEvaluator<board_size>::store_(uint64_t key,
+                                          const Evaluation &evaluation) {
+  if (key == 0) {
+    return;
+  }
+  // quantize outside the lock
+  Entry entry;
+  entry.key = key;
+  for (int i = 0; i < POLICY_SIZE; ++i) {
+    entry.policy[i] = static_cast<uint16_t>(
+        std::clamp(evaluation.policy_[i], 0.0f, 1.0f) * UINT16_MAX + 0.5f);
+  }
+  const float value = std::clamp(evaluation.value_, -1.0f, 1.0f) * INT16_MAX;
+  entry.value = static_cast<int16_t>(value < 0 ? value - 0.5f : value + 0.5f);
+  const size_t index = key & mask_;
+  std::lock_guard<std::mutex> lock(locks_[index % NN_CACHE_STRIPES]);
+  entries_[index] = entry;
+}
+
+template <int board_size>
+typename CachingEvaluator<board_size>::CacheStats
+CachingEvaluator<board_size>::get_cache_stats() const {
+  return {lookups_.load(std::memory_order_relaxed),
+          hits_.load(std::memory_order_relaxed)};
+}
+
+template <int board_size>
+std::string CachingEvaluator<board_size>::CacheStats::to_string() const {
+  std::stringstream ss;
+  ss << "cache lookups: " << lookups_ << ", hits: " << hits_
+     << ", hit rate: "
+     << (lookups_ == 0 ? 0.0 : static_cast<double>(hits_) / lookups_);
+  return ss.str();
+}
+
+#endif // ROOST_CACHINGEVALUATOR_H
@@ -6,23 +6,32 @@
 #define ROOST_EVALUATOR_H
 
 #include "game/GameState.h"
-#include <utility>
+#include <array>
 #include <vector>
 
 // TODO: replace with abstract evaluator when we implement NN
-class Evaluator {
+template <int board_size> class Evaluator {
 public:
   class Evaluation {
   public:
-    Evaluation(std::vector<float> policy, float value)
-        : policy_(std::move(policy)), value_(value) {}
-    // we always return a vector with length equal to the # of possible indices
-    // the MCTS is responsible for filtering out illegal actions
-    std::vector<float> policy_;
+    // one entry for every possible action index, stored inline so that
+    // evaluations never allocate; the MCTS is responsible for filtering out
+    // illegal actions
+    std::array<float, board_size * board_size + 1> policy_;
     // value ranges from 1 (black win) to -1 (white win)
     float value_;
   };
-  virtual Evaluation Evaluate(const game::GameState &state) = 0;
+  virtual Evaluation Evaluate(const game::GameState<board_size> &state) = 0;
+  // evaluates several unfinished states at once, writing the evaluation of
+  // states[i] to evaluations[i]; evaluators that can batch should override
+  // this
+  virtual void
+  EvaluateBatch(const std::vector<const game::GameState<board_size> *> &states,
+                Evaluation *evaluations) {
+    for (size_t i = 0; i < states.size(); ++i) {
+      evaluations[i] = Evaluate(*states[i]);
+    }
+  }
 };
 
 #endif // ROOST_EVALUATOR_H
@@ -6,42 +6,364 @@
 #define ROOST_MCTSPLAYER_H
 #include "AbstractPlayer.h"
 #include "Evaluator.h"
+#include "MCTS_defs.h"
 
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <random>
 #include <string>
-#include <unordered_map>
+#include <thread>
+#include <utility>
 #include <vector>
 
-class MCTSPlayer : public AbstractPlayer {
+// how a search with a playout target may cut itself short
+enum class MCTSPruning {
+  // always run the full target
+  NONE,
+  // stop once the most visited root move can't be overtaken by the
+  // playouts left
+  STOP_EARLY,
+  // also stop visiting root moves that can no longer catch up with it
+  PRUNE_CHILDREN
+};
+
+/* With search_threads > 1, one search runs on several threads that share the
+ * tree (tree parallelism). Each thread also descends to up to leaf_batch_size
+ * leaves before evaluating them together in one batch. A playout descending
+ * through an edge adds a virtual loss to it until it is backed up, which
+ * steers the other playouts in flight towards different leaves.
+ *
+ * The tree is kept between moves: play() moves the root down to the child
+ * for the move played, and the next search starts from that subtree's visits
+ * and only plays out enough to reach the playout target. A search that logs
+ * its visits for training starts from a fresh tree. With ponder_visits,
+ * ponder() grows the tree on a background thread until the root has that
+ * many visits; the arenas are sized for the larger of the two.
+ *
+ * The tree is a graph: a position reached by different move orders is one
+ * node, found through a transposition table, so its evaluation and subtree
+ * are shared by every edge into it. Visit counts are kept per edge, for
+ * PUCT and for choosing the move, while an edge's value is its child node's
+ * average over all the node's visits. Positions are keyed by stones, side to
+ * move, move number and passes; the move number keeps the graph acyclic.
+ * A node is only shared by positions with the same legal moves, and a move
+ * below it that superko forbids on some path only ends that path's playouts
+ * with the node's value. The network's evaluation of a shared node sees the
+ * history of the path that reached it first.
+ *
+ * With a time budget, get_move searches until the budget runs out, or until
+ * the most visited move at the root leads by more visits than the rest of
+ * the budget is expected to add; playouts then only caps the root's visits.
+ * pruning applies the same test to the playouts left without a time budget.
+ * Neither stops a search whose move is sampled from the visit counts. */
+template <int board_size>
+class MCTSPlayer : public AbstractPlayer<board_size> {
+  // statistics for the legal moves out of every node, one array per field:
+  // edge e is entry e of each. selection reads a few fields of all of a
+  // node's edges, which this keeps contiguous. edges live in blocks of
+  // MCTS_EDGE_BLOCK_SIZE that are only allocated once edges in them are
+  // claimed, so memory follows the branching of the tree rather than the
+  // number of points. a node's edges never straddle two blocks, and blocks
+  // don't move, so edges can be read while other threads claim more
+  class MCTSEdges {
+    static_assert(MCTS_EDGE_BLOCK_SIZE >= board_size * board_size + 1);
+    class Block {
+    public:
+      int action_idx[MCTS_EDGE_BLOCK_SIZE];
+      float P[MCTS_EDGE_BLOCK_SIZE];
+      std::atomic<int> child[MCTS_EDGE_BLOCK_SIZE];
+      std::atomic<int> N[MCTS_EDGE_BLOCK_SIZE];
+      std::atomic<float> W[MCTS_EDGE_BLOCK_SIZE];
+    };
+
+  public:
+    MCTSEdges() = default;
+    // room for the edges of max_nodes nodes
+    explicit MCTSEdges(int max_nodes)
+        : num_blocks_(max_nodes / (MCTS_EDGE_BLOCK_SIZE /
+                                   (board_size * board_size + 1)) +
+                      1),
+          blocks_(std::make_unique<std::atomic<Block *>[]>(num_blocks_)) {
+      for (size_t i = 0; i < num_blocks_; ++i) {
+        blocks_[i].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+    MCTSEdges(MCTSEdges &&other) noexcept { *this = std::move(other); }
+    MCTSEdges &operator=(MCTSEdges &&other) noexcept {
+      std::swap(num_blocks_, other.num_blocks_);
+      std::swap(blocks_, other.blocks_);
+      return *this;
+    }
+    ~MCTSEdges() {
+      for (size_t i = 0; i < num_blocks_; ++i) {
+        delete blocks_[i].load(std::memory_order_relaxed);
+      }
+    }
+    // the first of num_edges edges added after the first size edges, which
+    // starts the next block if they don't fit in the current one
+    static int place(int size, int num_edges) {
+      const int used = size % MCTS_EDGE_BLOCK_SIZE;
+      return used + num_edges > MCTS_EDGE_BLOCK_SIZE
+                 ? size - used + MCTS_EDGE_BLOCK_SIZE
+                 : size;
+    }
+    // allocates the block of edge e if no thread has yet
+    void allocate(int e) {
+      std::atomic<Block *> &block = blocks_[e / MCTS_EDGE_BLOCK_SIZE];
+      if (block.load(std::memory_order_acquire) == nullptr) {
+        auto *new_block = new Block;
+        Block *expected = nullptr;
+        if (!block.compare_exchange_strong(expected, new_block,
+                                           std::memory_order_acq_rel)) {
+          delete new_block;
+        }
+      }
+    }
+    int &action_idx(int e) const { return block_(e)->action_idx[offset_(e)]; }
+    float &P(int e) const { return block_(e)->P[offset_(e)]; }
+    // index of the resulting node in nodes_, or one of UNEXPANDED/EXPANDING;
+    // stays UNEXPANDED if the move ends the game. several edges may share a
+    // child
+    std::atomic<int> &child(int e) const {
+      return block_(e)->child[offset_(e)];
+    }
+    // visits and sum of values (from black's perspective) through the edge,
+    // including virtual losses of playouts in flight. W is only used as the
+    // edge's value while it has no child
+    std::atomic<int> &N(int e) const { return block_(e)->N[offset_(e)]; }
+    std::atomic<float> &W(int e) const { return block_(e)->W[offset_(e)]; }
+
+  private:
+    // an edge is only read after its node was published to the reader,
+    // which happens after its block was allocated
+    Block *block_(int e) const {
+      return blocks_[e / MCTS_EDGE_BLOCK_SIZE].load(std::memory_order_relaxed);
+    }
+    static int offset_(int e) { return e % MCTS_EDGE_BLOCK_SIZE; }
+    size_t num_blocks_ = 0;
+    std::unique_ptr<std::atomic<Block *>[]> blocks_;
+  };
   class MCTSNode {
   public:
-    // these represent counts for each child
-    // each has size (# of indices); this can be optimized later
-    std::vector<int> N;
-    std::vector<float> Q;
-    std::vector<float> P;
-    // our own value of N and Q
-    int Ns;
-    float Qs;
+    // key_() of the node's position
+    uint64_t key;
+    // a node's edges are edges_[first_edge, first_edge + num_edges), one per
+    // legal move in the order of get_legal_action_indexes()
+    int first_edge;
+    int num_edges;
+    // visits and sum of values through any parent, including virtual
+    // losses of playouts in flight; the node's evaluation counts as one
+    std::atomic<int> N;
+    std::atomic<float> W;
+  };
+  // an entry of the transposition table; node is EXPANDING until the
+  // position's node is added
+  class TableSlot {
+  public:
+    // 0 marks an empty slot
+    std::atomic<uint64_t> key;
+    std::atomic<int> node;
+  };
+  static constexpr int UNEXPANDED = -1;
+  static constexpr int EXPANDING = -2;
+  // one step of a playout: the node it left and the edge it took
+  class PathStep {
+  public:
+    int node;
+    int edge;
+    // the value added to the edge's W as virtual loss; node, unless it is
+    // the root, gets the opposite, a loss for the move that led to it
+    float virtual_loss;
+  };
+  // the steps of a playout, from the root down. a playout takes at most one
+  // step per move of the game, so the steps fit in a fixed array and
+  // selection never allocates
+  class Path {
+  public:
+    void clear() { size_ = 0; }
+    void push_back(const PathStep &step) {
+      assert(size_ < MAX_GAME_LENGTH(board_size));
+      steps_[size_++] = step;
+    }
+    [[nodiscard]] bool empty() const { return size_ == 0; }
+    [[nodiscard]] int size() const { return size_; }
+    const PathStep &operator[](int i) const { return steps_[i]; }
+    const PathStep &back() const { return steps_[size_ - 1]; }
+
+  private:
+    std::array<PathStep, MAX_GAME_LENGTH(board_size)> steps_;
+    int size_ = 0;
+  };
+  enum class LeafType {
+    // the playout ended the game; value holds the result
+    TERMINAL,
+    // the last edge was claimed (EXPANDING) and state must be evaluated
+    EXPAND,
+    // the playout reached a node or position another playout is expanding,
+    // and its virtual losses were undone
+    COLLISION
+  };
+  using Undo = typename game::GameState<board_size>::Undo;
+  // a playout that has descended to a leaf
+  class Leaf {
+  public:
+    Path path;
+    // the leaf's position, once it had to leave the state it was reached on
+    game::GameState<board_size> state;
+    float value;
+    // the table slot claimed for state's node, or -1
+    int slot;
   };
 
 public:
-  MCTSPlayer(std::shared_ptr<Evaluator> evaluator, int playouts = 250,
-             bool eval_mode = false, bool use_pcr = false, int pcr_small = 0,
-             int pcr_big = 0);
-  game::Action get_move(game::GameState state,
-                        std::string *playout_log) override;
-  game::Action get_move(game::GameState state) override;
-  float get_wr(game::GameState state) override;
+  // counters since construction
+  class ReuseStats {
+  public:
+    uint64_t searches_;
+    // searches that started from a subtree of an earlier one
+    uint64_t reused_searches_;
+    // root visits carried over into searches, and root visits when searches
+    // finished
+    uint64_t reused_visits_;
+    uint64_t total_visits_;
+    [[nodiscard]] std::string to_string() const;
+  };
+  // counters since construction, for searches without a time budget
+  class PruningStats {
+  public:
+    // searches that stopped before their playout target
+    uint64_t stopped_searches_;
+    // playouts those searches did not need to reach the target
+    uint64_t saved_playouts_;
+    [[nodiscard]] std::string to_string() const;
+  };
+
+  MCTSPlayer(std::shared_ptr<Evaluator<board_size>> evaluator,
+             int playouts = 250, bool eval_mode = false, bool use_pcr = false,
+             int pcr_small = 0, int pcr_big = 0, int search_threads = 1,
+             int leaf_batch_size = 1, int ponder_visits = 0,
+             MCTSPruning pruning = MCTSPruning::NONE);
+  ~MCTSPlayer();
+  // writes the root's visits to *playout_log as an SGF comment. the search
+  // starts from a fresh tree, so Match, which logs every move, never reuses
+  // one
+  game::Action<board_size> get_move(game::GameState<board_size> state,
+                                    std::string *playout_log) override;
+  // keeps the subtree of the position if play() led to it
+  game::Action<board_size> get_move(game::GameState<board_size> state) override;
+  float get_wr(game::GameState<board_size> state) override;
+  // moves the root down for the next unlogged search, as in GTP
+  void play(game::Action<board_size> action) override;
+  // does nothing unless ponder_visits was given
+  void ponder(game::GameState<board_size> state) override;
+  void stop_pondering() override;
+  void set_time_budget(double seconds) override;
   void reset() override;
   double get_eval_time() override;
+  [[nodiscard]] ReuseStats get_reuse_stats() const;
+  [[nodiscard]] PruningStats get_pruning_stats() const;
+  // edges that were linked to an existing node since construction
+  [[nodiscard]] uint64_t get_transpositions() const;
+  // the index of the edge with the highest PUCT score among num_edges edges
+  // with priors P, visits N and values Q from the mover's perspective (first
+  // play urgency for unvisited edges), skipping edges with fewer than min_N
+  // visits; -1 if every edge is skipped. uses AVX2 when compiled for it
+  static int puct_argmax(const float *P, const int *N, const float *Q,
+                         int num_edges, float explore_term, int min_N);
+  // the same without vector instructions; puct_argmax must agree with it
+  static int puct_argmax_scalar(const float *P, const int *N, const float *Q,
+                                int num_edges, float explore_term, int min_N);
 
 private:
-  float visit(const game::GameState &state);
-  void apply_dirichlet_noise_(const game::GameState &state);
-  std::shared_ptr<Evaluator> evaluator_;
-  std::unordered_map<game::GameState, MCTSNode> map_;
+  // evaluates states into evaluations[0, states.size()), timing the evaluator
+  void evaluate_(const std::vector<const game::GameState<board_size> *> &states,
+                 typename Evaluator<board_size>::Evaluation *evaluations);
+  // makes state's position the root at index 0, keeping the graph under it
+  // if it is the current root and a search to target_visits still fits in
+  // the arenas; returns whether the graph was kept
+  bool prepare_root_(const game::GameState<board_size> &state,
+                     int target_visits);
+  // drops the whole tree
+  void clear_tree_();
+  // whether state is the position at root_
+  [[nodiscard]] bool is_root_(const game::GameState<board_size> &state) const;
+  // copies the subtree under root_ to the spare arenas, with root_ at index
+  // 0, and swaps them in; the rest of the tree is freed along with the old
+  // arenas' contents
+  void compact_();
+  // adds state to the tree as a new node and returns the node's index
+  int add_node_(const game::GameState<board_size> &state,
+                const typename Evaluator<board_size>::Evaluation &eval);
+  // the transposition key of state's position; never 0
+  static uint64_t key_(const game::GameState<board_size> &state);
+  // looks key up in the table. returns its node, or EXPANDING if it is being
+  // expanded; otherwise claims a slot for it, sets *slot (-1 if the table
+  // is too crowded) and returns UNEXPANDED
+  int find_or_claim_(uint64_t key, int *slot);
+  // empties the table
+  void clear_table_();
+  // whether node has an edge for exactly state's legal moves
+  [[nodiscard]] bool same_moves_(int node,
+                                 const game::GameState<board_size> &state) const;
+  // runs playouts from the root, whose position is state, on search_threads_
+  // threads until num_playouts have completed, deadline passes or
+  // stop_search_ is set. with stop_when_decided, it also stops once the most
+  // visited root move leads by more visits than the search can still add
+  void search_(const game::GameState<board_size> &state, int num_playouts,
+               bool stop_when_decided = false,
+               std::chrono::steady_clock::time_point deadline =
+                   std::chrono::steady_clock::time_point::max());
+  // the playouts a search can still expect to run: playouts_left, or fewer
+  // if the deadline comes first at the rate since start
+  [[nodiscard]] static double
+  expected_playouts_(int playouts_done, int playouts_left,
+                     std::chrono::steady_clock::time_point start,
+                     std::chrono::steady_clock::time_point deadline);
+  // the most and second most visits among the root's edges
+  [[nodiscard]] std::pair<int, int> root_leaders_() const;
+  // descends from the root, whose position is *state, adding virtual losses
+  // along the way, and fills in leaf. the moves are played on *state, with
+  // undos[i] recording the move of leaf->path[i]
+  LeafType select_(game::GameState<board_size> *state, Undo *undos,
+                   Leaf *leaf);
+  // the index of the edge out of node with the highest PUCT score
+  int select_edge_(int node, game::Color turn) const;
+  // replaces the virtual losses along path with one visit of value
+  void backup_(const Path &path, float value);
+  // removes the virtual losses along path
+  void undo_virtual_losses_(const Path &path);
+  void apply_dirichlet_noise_(int node);
+  std::shared_ptr<Evaluator<board_size>> evaluator_;
+  // the tree lives in these two arenas and refers to nodes and edges by
+  // index; during a search nodes_[0] is the root. nodes_ is allocated once,
+  // large enough for the biggest search, and edges_ grows by blocks up to
+  // the edges of that many nodes. threads claim entries by bumping the
+  // counters. resetting the counters releases the whole tree, and keeps the
+  // edge blocks for the next one
+  int max_nodes_;
+  std::unique_ptr<MCTSNode[]> nodes_;
+  MCTSEdges edges_;
+  std::atomic<int> num_nodes_;
+  std::atomic<int> num_edges_;
+  // same size as nodes_; compact_() copies the kept nodes here
+  std::unique_ptr<MCTSNode[]> spare_nodes_;
+  // positions in the tree, with open addressing: a key is in one of the
+  // MCTS_TABLE_PROBES slots from key & table_mask_
+  std::unique_ptr<TableSlot[]> table_;
+  size_t table_mask_;
+  std::atomic<uint64_t> transpositions_;
+  // index of the root in nodes_, or -1 if there is no tree
+  int root_;
+  // the position at root_
+  game::GameState<board_size> root_state_;
+  // whether the root's priors already include dirichlet noise
+  bool root_noised_;
+  ReuseStats reuse_stats_;
+  PruningStats pruning_stats_;
   std::random_device rd_;
   std::mt19937 gen_;
   int playouts_;
@@ -49,7 +371,18 @@ private:
   bool use_pcr_;
   int pcr_small_;
   int pcr_big_;
-  double eval_time_;
+  int search_threads_;
+  int leaf_batch_size_;
+  int ponder_visits_;
+  // seconds per move, or 0 to search for playouts_ visits
+  double time_budget_;
+  MCTSPruning pruning_;
+  // with PRUNE_CHILDREN, root edges with fewer visits are not selected
+  std::atomic<int> root_prune_below_;
+  // runs the search started by ponder(), which stops once stop_search_ is set
+  std::thread ponder_thread_;
+  std::atomic<bool> stop_search_;
+  std::atomic<double> eval_time_;
 };
 
 #endif // ROOST_MCTSPLAYER_H
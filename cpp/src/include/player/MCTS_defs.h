@@ -10,7 +10,21 @@
 #define DIRICHLET_EPSILON_VAL 0.1
 #define MCTS_CPUCT 1.1
 #define MCTS_CFPU 0.2
+// visits counted as losses on an edge while a playout through it is in flight
+#define MCTS_VIRTUAL_LOSS 3
+// slots of the transposition table per node the tree can hold, and slots a
+// lookup tries before giving up on sharing the position
+#define MCTS_TABLE_SLOTS_PER_NODE 2
+#define MCTS_TABLE_PROBES 16
+// extra room in the arenas, as a share of the largest search, for nodes a
+// reused graph keeps beyond its root's visits
+#define MCTS_ARENA_SLACK 0.25
+// edges allocated at a time as the tree grows; holds a node's edges on any
+// supported board
+#define MCTS_EDGE_BLOCK_SIZE 4096
 #define PCR_P 0.25
+// when pondering, the root may gather this many times the playout target
+#define MCTS_PONDER_VISITS_FACTOR 2
 #define TEMP_0_MOVE_NUM_TRAIN 20
 #define TEMP_0_MOVE_NUM_VAL 16
 
@@ -6,226 +6,508 @@
 #ifndef ROOST_NNEVALUATOR_H
 #define ROOST_NNEVALUATOR_H
 #include "Evaluator.h"
+#include "InputEncoder.h"
+#include "game/Symmetry.h"
+#include "utils/MPSCQueue.h"
+#include <algorithm>
 #include <atomic>
 #include <chrono>
-#include <condition_variable>
-#include <ctime>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <memory>
-#include <mutex>
-#include <shared_mutex>
+#include <random>
+#include <sstream>
+#include <thread>
 #include <torch/script.h>
 #include <torch/torch.h>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
 // #define USE_CPU_ONLY
+// how long the inference thread waits for a batch to fill after its first
+// request arrives
+#define NN_BATCH_TIMEOUT_US 500
+#define NN_DEFAULT_MAX_BATCH_SIZE 32
+
+// which board symmetries a position is evaluated under
+enum class NNSymmetry {
+  // the board as it is
+  NONE,
+  // one of the 8, chosen at random for each evaluation
+  RANDOM,
+  // all 8 in the same batch, with the results averaged
+  AVERAGE
+};
 
 using namespace torch;
-template <int threads> class NNEvaluator : public Evaluator {
-public:
-  class Batch {
-  public:
-    Batch(std::shared_ptr<torch::jit::script::Module> module)
-        : module_(std::move(module)), loaded_threads_(0), threads_(threads),
-          done_processing_(false) {
-      memset(input_, 0, sizeof(input_));
-    }
-    // it is the caller's responsibility to ensure no duplicate slots
-    Evaluation Evaluate(const game::GameState &state, int slot) {
-      torch::NoGradGuard no_grad;
-      const game::Color *index_0 = state.get_board(0);
-      if (state.get_turn() == game::BLACK) {
-        for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; ++i) {
-          if (*(index_0 + i) == game::BLACK) {
-            input_[slot][0][i / BOARD_SIZE][i % BOARD_SIZE] = 1;
-          } else if (*(index_0 + i) == game::WHITE) {
-            input_[slot][1][i / BOARD_SIZE][i % BOARD_SIZE] = 1;
-          }
-          if (*(index_0 + i + BOARD_SIZE * BOARD_SIZE) == game::BLACK) {
-            input_[slot][2][i / BOARD_SIZE][i % BOARD_SIZE] = 1;
-          } else if (*(index_0 + i + BOARD_SIZE * BOARD_SIZE) == game::WHITE) {
-            input_[slot][3][i / BOARD_SIZE][i % BOARD_SIZE] = 1;
-          }
-          input_[slot][4][i / BOARD_SIZE][i % BOARD_SIZE] = 1;
-        }
-      } else {
-        for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; ++i) {
-          if (*(index_0 + i) == game::BLACK) {
-            input_[slot][1][i / BOARD_SIZE][i % BOARD_SIZE] = 1;
-          } else if (*(index_0 + i) == game::WHITE) {
-            input_[slot][0][i / BOARD_SIZE][i % BOARD_SIZE] = 1;
-          }
-          if (*(index_0 + i + BOARD_SIZE * BOARD_SIZE) == game::BLACK) {
-            input_[slot][3][i / BOARD_SIZE][i % BOARD_SIZE] = 1;
-          } else if (*(index_0 + i + BOARD_SIZE * BOARD_SIZE) == game::WHITE) {
-            input_[slot][2][i / BOARD_SIZE][i % BOARD_SIZE] = 1;
-          }
-        }
-      }
-      // if we are the last thread to finish, we do the evaluation
-      if (loaded_threads_.fetch_add(1) == threads_ - 1) {
-        Tensor input_tensor =
-            torch::from_blob(input_, {threads_, 5, BOARD_SIZE, BOARD_SIZE},
-                             TensorOptions().dtype(kFloat));
-        std::vector<torch::jit::IValue> inputs;
-#ifdef USE_CPU_ONLY
-        inputs.emplace_back(input_tensor);
-#else
-        inputs.emplace_back(input_tensor.to(at::kCUDA));
-#endif
-        auto output = module_->forward(inputs).toTuple()->elements();
-#ifdef USE_CPU_ONLY
-        std::unique_lock<std::shared_mutex> lock(policy_mtx_);
-        policy_output_ = torch::nn::functional::softmax(
-            output[0].toTensor(), torch::nn::functional::SoftmaxFuncOptions(1));
-        lock.unlock();
-#else
-        auto temp = output[0].toTensor();
-        temp = torch::nn::functional::softmax(
-            temp, torch::nn::functional::SoftmaxFuncOptions(1));
-        std::unique_lock<std::shared_mutex> lock(policy_mtx_);
-        policy_output_ = temp.to(torch::kCPU);
-        lock.unlock();
-#endif
-#ifdef USE_CPU_ONLY
-        value_output_ = output[1].toTensor();
-#else
-        value_output_ = output[1].toTensor().to(torch::kCPU);
-#endif
-        done_processing_ = true;
-        cv_.notify_all();
-      } else {
-        // otherwise, we block until finished or until some time passes
-        auto now = std::chrono::steady_clock::now();
-        std::unique_lock<std::mutex> ul(mtx_);
-        using namespace std::chrono_literals;
-        cv_.wait_until(ul, now + 250ms, [this] { return done_processing_; });
-        if (!done_processing_) {
-          Tensor input_tensor =
-              torch::from_blob(input_, {threads_, 5, BOARD_SIZE, BOARD_SIZE},
-                               TensorOptions().dtype(kFloat));
-          std::vector<torch::jit::IValue> inputs;
-#ifdef USE_CPU_ONLY
-          inputs.emplace_back(input_tensor);
-#else
-          inputs.emplace_back(input_tensor.to(at::kCUDA));
-#endif
-          auto output = module_->forward(inputs).toTuple()->elements();
+
+// loads a TorchScript model onto the device evaluations run on
+inline std::shared_ptr<torch::jit::script::Module>
+load_model(const std::string &input_file) {
+  auto module = std::make_shared<torch::jit::script::Module>();
+  try {
+    std::cerr << "loading model " + input_file + "\n";
 #ifdef USE_CPU_ONLY
-          std::unique_lock<std::shared_mutex> lock(policy_mtx_);
-          policy_output_ = torch::nn::functional::softmax(
-              output[0].toTensor(),
-              torch::nn::functional::SoftmaxFuncOptions(1));
-          lock.unlock();
+    *module = torch::jit::load(input_file);
 #else
-          auto temp = output[0].toTensor();
-          temp = torch::nn::functional::softmax(
-              temp, torch::nn::functional::SoftmaxFuncOptions(1));
-          std::unique_lock<std::shared_mutex> lock(policy_mtx_);
-          policy_output_ = temp.to(torch::kCPU);
-          lock.unlock();
+    *module = torch::jit::load(input_file, torch::kCUDA);
 #endif
+    std::cerr << "model " + input_file + " loaded successfully\n";
+  } catch (const c10::Error &e) {
+    std::cerr << "error loading model " + input_file + "\n";
+    std::cerr << e.what() << std::endl;
+    assert(false);
+  }
+  return module;
+}
+
+/* Evaluations are served by a dedicated inference thread. Callers encode
+ * their positions, push requests onto a lock-free queue and wait for them to
+ * complete; the inference thread runs a batch as soon as it holds the target
+ * number of requests or batch_timeout has passed since the batch's first
+ * request. Batches go through staging tensors allocated once, in page-locked
+ * memory so that host-device copies can be asynchronous, and results are
+ * written straight into the callers' Evaluations: nothing is allocated per
+ * evaluation.
+ *
+ * The target adapts between 1 and max_batch_size: a batch that runs on its
+ * deadline means requests are arriving more slowly than the target assumes
+ * (e.g. games finishing near the end of a run), so the target shrinks; a
+ * full batch that leaves at least as many requests queued behind it means
+ * the device is the bottleneck, so the target grows.
+ *
+ * Positions may be evaluated under a symmetry of the board: the input is
+ * encoded transformed and the inference thread maps the policy back through
+ * the same precomputed table while writing the result. NNSymmetry::RANDOM
+ * varies the evaluations of self-play at no cost; NNSymmetry::AVERAGE costs 8
+ * rows of the batch per position in exchange for a less noisy evaluation. */
+template <int board_size> class NNEvaluator : public Evaluator<board_size> {
+public:
+  using Evaluation = typename Evaluator<board_size>::Evaluation;
+  // counters since construction
+  class BatchStats {
+  public:
+    uint64_t batches_;
+    uint64_t evaluations_;
+    // batches that ran on their deadline instead of reaching the target
+    uint64_t timed_out_batches_;
+    double forward_seconds_;
+    int target_batch_size_;
+    [[nodiscard]] std::string to_string() const;
+  };
+
+  // max_batch_size should be about the number of threads evaluating at once,
+  // times NUM_SYMMETRIES with NNSymmetry::AVERAGE.
+  // the number of history boards in the input is read from the model's
+  // history_len attribute, or NN_DEFAULT_HISTORY_LEN if it has none
+  explicit NNEvaluator(const std::string &input_file = "",
+                       int max_batch_size = NN_DEFAULT_MAX_BATCH_SIZE,
+                       NNSymmetry symmetry = NNSymmetry::NONE,
+                       std::chrono::microseconds batch_timeout =
+                           std::chrono::microseconds(NN_BATCH_TIMEOUT_US));
+  // evaluates with a model already returned by load_model
+  explicit NNEvaluator(std::shared_ptr<torch::jit::script::Module> module,
+                       int max_batch_size = NN_DEFAULT_MAX_BATCH_SIZE,
+                       NNSymmetry symmetry = NNSymmetry::NONE,
+                       std::chrono::microseconds batch_timeout =
+                           std::chrono::microseconds(NN_BATCH_TIMEOUT_US));
+  ~NNEvaluator();
+  Evaluation Evaluate(const game::GameState<board_size> &state) override;
+  // queues every state at once, so they can share batches
+  void
+  EvaluateBatch(const std::vector<const game::GameState<board_size> *> &states,
+                Evaluation *evaluations) override;
+  // may be called from any thread while evaluations are running
+  [[nodiscard]] BatchStats get_batch_stats() const;
+  [[nodiscard]] NNSymmetry get_symmetry() const { return symmetry_; }
+  // number of history boards the model's input depends on
+  [[nodiscard]] int get_history_len() const {
+    return encoder_.get_history_len();
+  }
+
+private:
+  static constexpr int POLICY_SIZE = board_size * board_size + 1;
+
+  // shared by the requests of one Evaluate or EvaluateBatch call, which
+  // waits until remaining reaches 0. the inference thread never touches it
+  // again after the last decrement, so it can live on the caller's stack
+  class Completion {
+  public:
+    std::atomic<int> remaining;
+    std::exception_ptr error;
+  };
+  class Request : public MPSCNode {
+  public:
+    // room for the longest history; only the first input_size_ floats are
+    // used
+    float input[2 * GAME_HISTORY_LEN + 1][board_size][board_size];
+    // where the inference thread writes the result
+    Evaluation *result;
+    Completion *completion;
+    // the symmetry input was encoded under
+    int symmetry;
+  };
+  // evaluates num_states positions, none of them finished, into evaluations
+  void evaluate_(const game::GameState<board_size> *const *states,
+                 size_t num_states, Evaluation *evaluations);
+  // encodes state under request->symmetry into request and queues it
+  void submit_(const game::GameState<board_size> &state, Request *request);
+  // blocks until every request of completion is done; rethrows the error of
+  // a failed batch
+  void wait_(Completion *completion);
+  // called by the inference thread once request's result has been written,
+  // or with the exception that prevented it
+  static void complete_(Request *request, std::exception_ptr error);
+  // body of the inference thread
+  void serve_();
+  // runs the first batch_size requests of batch_ through the network and
+  // completes them
+  void run_batch_(int batch_size, bool timed_out);
+  // updates the counters and the target batch size after a forward pass that
+  // began at start; must run before the batch's requests are completed, so
+  // that the queue only holds requests that arrived during the pass
+  void record_batch_(int batch_size, bool timed_out,
+                     std::chrono::steady_clock::time_point start);
+  std::shared_ptr<torch::jit::script::Module> module_;
+  InputEncoder<board_size> encoder_;
+  // floats in one position's input planes
+  int input_size_;
+  const int max_batch_size_;
+  const NNSymmetry symmetry_;
+  std::chrono::microseconds batch_timeout_;
+  MPSCQueue<Request> queue_;
+  // requests pushed but not yet popped; the inference thread sleeps on this
+  // while it is 0
+  std::atomic<int> pending_;
+  std::atomic<bool> stop_;
+  // only written by the inference thread
+  std::atomic<int> target_batch_size_;
+  std::atomic<uint64_t> batches_;
+  std::atomic<uint64_t> evaluations_;
+  std::atomic<uint64_t> timed_out_batches_;
+  std::atomic<double> forward_seconds_;
+  // bumped after each batch's requests are completed; callers wait on this
+  // rather than on their Completion, which may be gone by the time the
+  // inference thread would notify it
+  std::atomic<int> completed_batches_;
+  std::unique_ptr<Request *[]> batch_;
+  // staging tensors with room for max_batch_size_ positions, reused by every
+  // batch. the host ones are page-locked unless USE_CPU_ONLY is defined
+  Tensor input_;
+  Tensor device_input_;
+  Tensor policy_output_;
+  Tensor value_output_;
+  std::thread server_;
+};
+
+template <int board_size>
+NNEvaluator<board_size>::NNEvaluator(const std::string &input_file,
+                                     int max_batch_size, NNSymmetry symmetry,
+                                     std::chrono::microseconds batch_timeout)
+    : NNEvaluator(load_model(input_file), max_batch_size, symmetry,
+                  batch_timeout) {}
+
+template <int board_size>
+NNEvaluator<board_size>::NNEvaluator(
+    std::shared_ptr<torch::jit::script::Module> module, int max_batch_size,
+    NNSymmetry symmetry, std::chrono::microseconds batch_timeout)
+    : module_(std::move(module)),
+      max_batch_size_(std::max(max_batch_size, 1)), symmetry_(symmetry),
+      batch_timeout_(batch_timeout), pending_(0), stop_(false),
+      target_batch_size_(max_batch_size_), batches_(0), evaluations_(0),
+      timed_out_batches_(0), forward_seconds_(0.0), completed_batches_(0),
+      batch_(new Request *[max_batch_size_]) {
+  module_->eval();
+  if (module_->hasattr("history_len")) {
+    encoder_ = InputEncoder<board_size>(
+        static_cast<int>(module_->attr("history_len").toInt()));
+  }
+  // at::globalContext().setBenchmarkCuDNN(false);
+  input_size_ = encoder_.get_num_planes() * board_size * board_size;
 #ifdef USE_CPU_ONLY
-          value_output_ = output[1].toTensor();
+  const TensorOptions host_options = TensorOptions().dtype(kFloat);
 #else
-          value_output_ = output[1].toTensor().to(torch::kCPU);
+  const TensorOptions host_options =
+      TensorOptions().dtype(kFloat).pinned_memory(true);
+  device_input_ =
+      torch::empty({max_batch_size_, encoder_.get_num_planes(), board_size,
+                    board_size},
+                   TensorOptions().dtype(kFloat).device(torch::kCUDA));
 #endif
-          done_processing_ = true;
-          cv_.notify_all();
-        }
+  input_ = torch::empty(
+      {max_batch_size_, encoder_.get_num_planes(), board_size, board_size},
+      host_options);
+  policy_output_ = torch::empty({max_batch_size_, POLICY_SIZE}, host_options);
+  value_output_ = torch::empty({max_batch_size_}, host_options);
+  server_ = std::thread(&NNEvaluator::serve_, this);
+}
+
+template <int board_size>
+NNEvaluator<board_size>::~NNEvaluator() {
+  stop_ = true;
+  // wake the inference thread if it is asleep
+  ++pending_;
+  pending_.notify_one();
+  server_.join();
+}
+
+// TODO: refactor this so it doesn't break abstraction for gamestate
+template <int board_size>
+typename Evaluator<board_size>::Evaluation
+NNEvaluator<board_size>::Evaluate(
+    const game::GameState<board_size> &state) {
+  Evaluation evaluation;
+  if (state.done()) {
+    evaluation.policy_.fill(0.0f);
+    evaluation.value_ = (state.winner() == game::BLACK ? 1.0f : -1.0f);
+    return evaluation;
+  }
+  const game::GameState<board_size> *states[] = {&state};
+  evaluate_(states, 1, &evaluation);
+  return evaluation;
+}
+
+template <int board_size>
+void NNEvaluator<board_size>::EvaluateBatch(
+    const std::vector<const game::GameState<board_size> *> &states,
+    Evaluation *evaluations) {
+  for (const auto *state : states) {
+    assert(!state->done());
+  }
+  evaluate_(states.data(), states.size(), evaluations);
+}
+
+template <int board_size>
+void NNEvaluator<board_size>::evaluate_(
+    const game::GameState<board_size> *const *states, size_t num_states,
+    Evaluation *evaluations) {
+  const size_t per_state =
+      symmetry_ == NNSymmetry::AVERAGE ? NUM_SYMMETRIES : 1;
+  const size_t num_requests = num_states * per_state;
+  // requests are too big for the stack; keep one buffer per thread
+  thread_local std::unique_ptr<Request[]> requests;
+  thread_local size_t capacity = 0;
+  if (capacity < num_requests) {
+    capacity = num_requests;
+    requests.reset(new Request[capacity]);
+  }
+  // with AVERAGE, the results of each symmetry before they are combined
+  thread_local std::vector<Evaluation> symmetric;
+  Evaluation *results = evaluations;
+  if (symmetry_ == NNSymmetry::AVERAGE) {
+    symmetric.resize(std::max(symmetric.size(), num_requests));
+    results = symmetric.data();
+  }
+  thread_local std::minstd_rand rng(std::random_device{}());
+  Completion completion;
+  completion.remaining = static_cast<int>(num_requests);
+  for (size_t i = 0; i < num_requests; ++i) {
+    Request &request = requests[i];
+    request.result = &results[i];
+    request.completion = &completion;
+    switch (symmetry_) {
+    case NNSymmetry::NONE:
+      request.symmetry = 0;
+      break;
+    case NNSymmetry::RANDOM:
+      request.symmetry = static_cast<int>(rng() % NUM_SYMMETRIES);
+      break;
+    case NNSymmetry::AVERAGE:
+      request.symmetry = static_cast<int>(i % NUM_SYMMETRIES);
+      break;
+    }
+    submit_(*states[i / per_state], &request);
+  }
+  wait_(&completion);
+  if (symmetry_ != NNSymmetry::AVERAGE) {
+    return;
+  }
+  for (size_t i = 0; i < num_states; ++i) {
+    const Evaluation *first = &results[i * NUM_SYMMETRIES];
+    Evaluation &evaluation = evaluations[i];
+    evaluation = first[0];
+    for (int s = 1; s < NUM_SYMMETRIES; ++s) {
+      for (int j = 0; j < POLICY_SIZE; ++j) {
+        evaluation.policy_[j] += first[s].policy_[j];
       }
-      std::shared_lock<std::shared_mutex> lock(policy_mtx_);
-      std::vector<float> policy(
-          policy_output_.data_ptr<float>() +
-              (slot * (BOARD_SIZE * BOARD_SIZE + 1)),
-          policy_output_.data_ptr<float>() +
-              ((slot + 1) * (BOARD_SIZE * BOARD_SIZE + 1)));
-      return {policy, value_output_[slot].item<float>()};
+      evaluation.value_ += first[s].value_;
+    }
+    for (float &p : evaluation.policy_) {
+      p /= NUM_SYMMETRIES;
     }
+    evaluation.value_ /= NUM_SYMMETRIES;
+  }
+}
 
-    std::shared_ptr<torch::jit::script::Module> module_;
-    float input_[threads][5][BOARD_SIZE][BOARD_SIZE];
-    Tensor policy_output_;
-    Tensor value_output_;
-    std::atomic<int> loaded_threads_;
-    int threads_;
-    std::shared_mutex policy_mtx_;
-    std::mutex mtx_;
-    std::condition_variable cv_;
-    bool done_processing_;
-  };
+template <int board_size>
+void NNEvaluator<board_size>::submit_(
+    const game::GameState<board_size> &state, Request *request) {
+  encoder_.encode(state, &request->input[0][0][0], request->symmetry);
+  queue_.push(request);
+  ++pending_;
+  pending_.notify_one();
+}
 
-  explicit NNEvaluator(const std::string &input_file = "");
-  Evaluation Evaluate(const game::GameState &state) override;
+template <int board_size>
+void NNEvaluator<board_size>::wait_(Completion *completion) {
+  // read the counter first: if remaining drops after we check it, the
+  // counter has moved on too and wait() returns immediately
+  int seen = completed_batches_.load(std::memory_order_acquire);
+  while (completion->remaining.load(std::memory_order_acquire) != 0) {
+    completed_batches_.wait(seen, std::memory_order_acquire);
+    seen = completed_batches_.load(std::memory_order_acquire);
+  }
+  if (completion->error) {
+    std::rethrow_exception(completion->error);
+  }
+}
 
-private:
-  std::shared_ptr<torch::jit::script::Module> module_;
-  int batch_size_;
-  int global_counter_;
-  // TODO: test better data structures; unordered_map overhead may be high
-  std::unordered_map<int, int> counters_;
-  std::unordered_map<int, std::shared_ptr<Batch>> batch_map_;
-  // protects maps and global counter
-  std::mutex mtx_;
-};
+template <int board_size>
+void NNEvaluator<board_size>::complete_(Request *request,
+                                        std::exception_ptr error) {
+  Completion *completion = request->completion;
+  if (error) {
+    completion->error = error;
+  }
+  completion->remaining.fetch_sub(1, std::memory_order_release);
+}
+
+template <int board_size>
+void NNEvaluator<board_size>::serve_() {
+  int batch_size = 0;
+  std::chrono::steady_clock::time_point deadline;
+  while (true) {
+    Request *request = queue_.pop();
+    if (request != nullptr) {
+      --pending_;
+      if (batch_size == 0) {
+        deadline = std::chrono::steady_clock::now() + batch_timeout_;
+      }
+      batch_[batch_size++] = request;
+      if (batch_size >= target_batch_size_.load(std::memory_order_relaxed)) {
+        run_batch_(batch_size, false);
+        batch_size = 0;
+      }
+    } else if (batch_size > 0) {
+      // partial batch: keep polling until it fills or its deadline passes
+      if (std::chrono::steady_clock::now() >= deadline) {
+        run_batch_(batch_size, true);
+        batch_size = 0;
+      } else {
+        std::this_thread::yield();
+      }
+    } else if (stop_) {
+      return;
+    } else if (pending_ == 0) {
+      pending_.wait(0);
+    } else {
+      // a push is halfway done
+      std::this_thread::yield();
+    }
+  }
+}
 
-template <int threads>
-NNEvaluator<threads>::NNEvaluator(const std::string &input_file)
-    : batch_size_(threads), global_counter_(0) {
+template <int board_size>
+void NNEvaluator<board_size>::run_batch_(int batch_size, bool timed_out) {
+  torch::NoGradGuard no_grad;
+  float *input_data = input_.data_ptr<float>();
+  for (int i = 0; i < batch_size; ++i) {
+    memcpy(input_data + i * input_size_, batch_[i]->input,
+           input_size_ * sizeof(float));
+  }
+  auto start = std::chrono::steady_clock::now();
   try {
-    std::cerr << "loading model " + input_file + "\n";
-    module_ = std::make_shared<torch::jit::script::Module>();
 #ifdef USE_CPU_ONLY
-    *module_ = torch::jit::load(input_file);
+    Tensor batch_input = input_.narrow(0, 0, batch_size);
 #else
-    *module_ = torch::jit::load(input_file, torch::kCUDA);
+    // asynchronous; the forward pass is queued behind it on the same stream,
+    // and input_ is not touched again until the blocking copies below
+    Tensor batch_input = device_input_.narrow(0, 0, batch_size);
+    batch_input.copy_(input_.narrow(0, 0, batch_size), true);
 #endif
-    module_->eval();
-    // at::globalContext().setBenchmarkCuDNN(false);
-    std::cerr << "model " + input_file + " loaded successfully\n";
-  } catch (const c10::Error &e) {
-    std::cerr << "error loading model " + input_file + "\n";
-    std::cerr << e.what() << std::endl;
-    assert(false);
+    std::vector<torch::jit::IValue> inputs;
+    inputs.emplace_back(batch_input);
+    auto output = module_->forward(inputs).toTuple()->elements();
+    Tensor policy = torch::nn::functional::softmax(
+        output[0].toTensor(), torch::nn::functional::SoftmaxFuncOptions(1));
+    // these wait for the forward pass to finish
+    policy_output_.narrow(0, 0, batch_size).copy_(policy);
+    value_output_.narrow(0, 0, batch_size)
+        .copy_(output[1].toTensor().reshape({batch_size}));
+    record_batch_(batch_size, timed_out, start);
+    const float *policy_data = policy_output_.data_ptr<float>();
+    const float *value_data = value_output_.data_ptr<float>();
+    for (int i = 0; i < batch_size; ++i) {
+      Evaluation *result = batch_[i]->result;
+      const float *policy_row = policy_data + i * POLICY_SIZE;
+      const int symmetry = batch_[i]->symmetry;
+      if (symmetry == 0) {
+        memcpy(result->policy_.data(), policy_row, sizeof(result->policy_));
+      } else {
+        // the network saw move j at forward[j]
+        const auto &forward = game::Symmetry<board_size>::forward(symmetry);
+        for (int j = 0; j < POLICY_SIZE; ++j) {
+          result->policy_[j] = policy_row[forward[j]];
+        }
+      }
+      result->value_ = value_data[i];
+      complete_(batch_[i], nullptr);
+    }
+  } catch (...) {
+    for (int i = 0; i < batch_size; ++i) {
+      complete_(batch_[i], std::current_exception());
+    }
   }
+  completed_batches_.fetch_add(1, std::memory_order_release);
+  completed_batches_.notify_all();
 }
 
-// TODO: refactor this so it doesn't break abstraction for gamestate
-template <int threads>
-Evaluator::Evaluation
-NNEvaluator<threads>::Evaluate(const game::GameState &state) {
-  if (state.done()) {
-    return {{}, (state.winner() == game::BLACK ? 1.0f : -1.0f)};
-  }
-  mtx_.lock();
-  // each request is assigned a unique counter
-  const int counter = global_counter_;
-  ++global_counter_;
-  // prevent counter overflow
-  if (global_counter_ == batch_size_ * 1e7) {
-    global_counter_ = 0;
-  }
-  const int batch_idx = counter / batch_size_;
-  // if previous batches are full, start a new one
-  if (counter % batch_size_ == 0) {
-    counters_[batch_idx] = 0;
-    batch_map_[batch_idx] = std::make_shared<Batch>(module_);
-  }
-  std::shared_ptr<Batch> batch = batch_map_[batch_idx];
-  mtx_.unlock();
-  Evaluation return_eval = batch->Evaluate(state, counter % batch_size_);
-  mtx_.lock();
-  if (++counters_[batch_idx] < batch_size_) {
-    // not the last thread; we can leave
-    mtx_.unlock();
-    return return_eval;
-  }
-  // last thread is responsible for deallocation + erase
-  batch_map_.erase(batch_idx);
-  counters_.erase(batch_idx);
-  mtx_.unlock();
-  return return_eval;
+template <int board_size>
+void NNEvaluator<board_size>::record_batch_(
+    int batch_size, bool timed_out,
+    std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  forward_seconds_.store(forward_seconds_.load(std::memory_order_relaxed) +
+                             elapsed.count(),
+                         std::memory_order_relaxed);
+  batches_.fetch_add(1, std::memory_order_relaxed);
+  evaluations_.fetch_add(batch_size, std::memory_order_relaxed);
+
+  int target = target_batch_size_.load(std::memory_order_relaxed);
+  if (timed_out) {
+    // halve rather than jump to batch_size, so one late request does not
+    // collapse the target
+    timed_out_batches_.fetch_add(1, std::memory_order_relaxed);
+    target = std::max(batch_size, target / 2);
+  } else if (pending_.load(std::memory_order_relaxed) >= target) {
+    // a whole batch queued up while the device was busy
+    target = std::min(2 * target, max_batch_size_);
+  }
+  target_batch_size_.store(target, std::memory_order_relaxed);
+}
+
+template <int board_size>
+typename NNEvaluator<board_size>::BatchStats
+NNEvaluator<board_size>::get_batch_stats() const {
+  return {batches_.load(std::memory_order_relaxed),
+          evaluations_.load(std::memory_order_relaxed),
+          timed_out_batches_.load(std::memory_order_relaxed),
+          forward_seconds_.load(std::memory_order_relaxed),
+          target_batch_size_.load(std::memory_order_relaxed)};
+}
+
+template <int board_size>
+std::string NNEvaluator<board_size>::BatchStats::to_string() const {
+  std::stringstream ss;
+  ss << "batches: " << batches_ << ", evaluations: " << evaluations_
+     << ", avg batch size: "
+     << (batches_ == 0 ? 0.0 : static_cast<double>(evaluations_) / batches_)
+     << ", timed out: " << timed_out_batches_
+     << ", forward time: " << forward_seconds_
+     << "s, target batch size: " << target_batch_size_;
+  return ss.str();
 }
 
-#endif // ROOST_NNEVALUATOR_H
+#endif // ROOST_NNEVALUATOR_H
\ No newline at end of file
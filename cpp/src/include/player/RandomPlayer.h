@@ -8,10 +8,11 @@
 #include "AbstractPlayer.h"
 #include <random>
 
-class RandomPlayer : public AbstractPlayer {
+template <int board_size>
+class RandomPlayer : public AbstractPlayer<board_size> {
 public:
   RandomPlayer();
-  game::Action get_move(game::GameState state) override;
+  game::Action<board_size> get_move(game::GameState<board_size> state) override;
 
 private:
   std::random_device rd_;
@@ -0,0 +1,71 @@
+//
+// Created by Jeremy on 2/13/2022.
+//
+
+#ifndef ROOST_MPSCQUEUE_H
+#define ROOST_MPSCQUEUE_H
+#include <atomic>
+
+// element of an MPSCQueue; queued types derive from this
+class MPSCNode {
+public:
+  std::atomic<MPSCNode *> next{nullptr};
+};
+
+/* Lock-free intrusive queue with many producers and a single consumer
+ * (Vyukov's MPSC queue). push never blocks and never allocates; the queue
+ * does not own its nodes, which must stay alive until they are popped. */
+template <typename T> class MPSCQueue {
+public:
+  MPSCQueue() : head_(&stub_), tail_(&stub_) {}
+  MPSCQueue(const MPSCQueue &) = delete;
+  MPSCQueue &operator=(const MPSCQueue &) = delete;
+
+  // may be called from any thread
+  void push(T *node) { push_(node); }
+
+  // returns the oldest node, or nullptr if the queue is empty or the oldest
+  // push has not finished yet; only the consumer thread may call this
+  T *pop() {
+    MPSCNode *tail = tail_;
+    MPSCNode *next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (next == nullptr) {
+        return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+      tail_ = next;
+      return static_cast<T *>(tail);
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    // tail is the only node; put the stub behind it so it can be unlinked
+    push_(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      tail_ = next;
+      return static_cast<T *>(tail);
+    }
+    return nullptr;
+  }
+
+private:
+  void push_(MPSCNode *node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    MPSCNode *prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // most recently pushed node
+  std::atomic<MPSCNode *> head_;
+  // next node to pop; only touched by the consumer
+  MPSCNode *tail_;
+  MPSCNode stub_;
+};
+
+#endif // ROOST_MPSCQUEUE_H
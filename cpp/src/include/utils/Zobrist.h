@@ -4,9 +4,10 @@
 
 #ifndef ROOST_ZOBRIST_H
 #define ROOST_ZOBRIST_H
+#include <cstddef>
 #include <vector>
 
-/* Zobrist for GameState uses BOARD_SIZE * BOARD_SIZE * 2 + 1 features. These
+/* Zobrist for GameState uses board_size * board_size * 2 + 1 features. These
  * correspond to black stones on the current board, white stones, and whether
  * black is to move */
 
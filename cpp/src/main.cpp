@@ -1,8 +1,10 @@
 #include "game/GameState.h"
 #include "play/GTP.h"
 #include "play/Match.h"
+#include "player/CachingEvaluator.h"
 #include "player/Evaluator.h"
 #include "player/MCTSPlayer.h"
+#include "player/MCTS_defs.h"
 #include "player/NNEvaluator.h"
 #include "player/RandomPlayer.h"
 #include <atomic>
@@ -11,15 +13,64 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
 
 using namespace game;
 namespace fs = std::filesystem;
 
+// reads the board size a model was trained on from its board_size attribute;
+// models exported before the attribute existed are 9x9
+int model_board_size(const torch::jit::script::Module &module) {
+  if (!module.hasattr("board_size")) {
+    return DEFAULT_BOARD_SIZE;
+  }
+  return static_cast<int>(module.attr("board_size").toInt());
+}
+
+// calls f with std::integral_constant<int, board_size>, so that a runtime
+// board size selects one of the compiled-in instantiations
+template <typename F> void with_board_size(int board_size, F &&f) {
+  switch (board_size) {
+  case 9:
+    f(std::integral_constant<int, 9>{});
+    break;
+  case 13:
+    f(std::integral_constant<int, 13>{});
+    break;
+  case 19:
+    f(std::integral_constant<int, 19>{});
+    break;
+  default:
+    throw std::invalid_argument("unsupported board size " +
+                                std::to_string(board_size));
+  }
+}
+
+NNSymmetry parse_symmetry(const std::string &name) {
+  if (name == "none") {
+    return NNSymmetry::NONE;
+  } else if (name == "random") {
+    return NNSymmetry::RANDOM;
+  } else if (name == "average") {
+    return NNSymmetry::AVERAGE;
+  }
+  throw std::invalid_argument("unknown symmetry " + name);
+}
+
+template <int board_size>
 void generate_data(int num_threads, int games, int playouts,
-                   const std::string &model_file, const std::string &save_dir) {
-  std::shared_ptr<Evaluator> eval =
-      std::make_shared<NNEvaluator<32>>(model_file);
+                   std::shared_ptr<torch::jit::script::Module> model,
+                   const std::string &save_dir, int max_batch_size) {
+  std::shared_ptr<NNEvaluator<board_size>> nn_eval =
+      std::make_shared<NNEvaluator<board_size>>(std::move(model),
+                                                max_batch_size);
+  // shared by every game, which all start from the same position
+  std::shared_ptr<CachingEvaluator<board_size>> cache =
+      std::make_shared<CachingEvaluator<board_size>>(
+          nn_eval, NN_CACHE_DEFAULT_ENTRIES, nn_eval->get_history_len());
+  std::shared_ptr<Evaluator<board_size>> eval = cache;
   std::shared_ptr<std::atomic<int>> win_counter =
       std::make_shared<std::atomic<int>>(0);
   std::shared_ptr<std::atomic<int>> game_counter =
@@ -28,11 +79,12 @@ void generate_data(int num_threads, int games, int playouts,
       std::chrono::system_clock::now();
   auto task = [&, eval, num_threads, playouts, win_counter,
                game_counter](int tid, int games) {
-    std::shared_ptr<AbstractPlayer> black =
-        std::make_shared<MCTSPlayer>(eval, playouts);
-    std::shared_ptr<AbstractPlayer> white =
-        std::make_shared<MCTSPlayer>(eval, playouts);
-    Match m(black, white);
+    // every search's root visits are a policy target, so none stops early
+    std::shared_ptr<MCTSPlayer<board_size>> black =
+        std::make_shared<MCTSPlayer<board_size>>(eval, playouts);
+    std::shared_ptr<MCTSPlayer<board_size>> white =
+        std::make_shared<MCTSPlayer<board_size>>(eval, playouts);
+    Match<board_size> m(black, white);
 
     for (int i = tid; i < games; i += num_threads) {
       float res = m.run(i);
@@ -59,14 +111,23 @@ void generate_data(int num_threads, int games, int playouts,
   for (int i = 0; i < num_threads; ++i) {
     threads[i].join();
   }
+  std::cout << nn_eval->get_batch_stats().to_string() << "\n"
+            << cache->get_cache_stats().to_string() << std::endl;
   fs::current_path(starting_path);
 }
 
+template <int board_size>
 void generate_data_pcr(int num_threads, int games, int small, int big,
-                       const std::string &model_file,
-                       const std::string &save_dir) {
-  std::shared_ptr<Evaluator> eval =
-      std::make_shared<NNEvaluator<96>>(model_file);
+                       std::shared_ptr<torch::jit::script::Module> model,
+                       const std::string &save_dir, int max_batch_size) {
+  std::shared_ptr<NNEvaluator<board_size>> nn_eval =
+      std::make_shared<NNEvaluator<board_size>>(std::move(model),
+                                                max_batch_size);
+  // shared by every game, which all start from the same position
+  std::shared_ptr<CachingEvaluator<board_size>> cache =
+      std::make_shared<CachingEvaluator<board_size>>(
+          nn_eval, NN_CACHE_DEFAULT_ENTRIES, nn_eval->get_history_len());
+  std::shared_ptr<Evaluator<board_size>> eval = cache;
   std::shared_ptr<std::atomic<int>> win_counter =
       std::make_shared<std::atomic<int>>(0);
   std::shared_ptr<std::atomic<int>> game_counter =
@@ -76,11 +137,13 @@ void generate_data_pcr(int num_threads, int games, int small, int big,
 
   auto task = [&, eval, num_threads, small, big, win_counter,
                game_counter](int tid, int games) {
-    std::shared_ptr<AbstractPlayer> black =
-        std::make_shared<MCTSPlayer>(eval, -1, false, true, small, big);
-    std::shared_ptr<AbstractPlayer> white =
-        std::make_shared<MCTSPlayer>(eval, -1, false, true, small, big);
-    Match m(black, white);
+    std::shared_ptr<MCTSPlayer<board_size>> black =
+        std::make_shared<MCTSPlayer<board_size>>(eval, -1, false, true, small,
+                                                 big);
+    std::shared_ptr<MCTSPlayer<board_size>> white =
+        std::make_shared<MCTSPlayer<board_size>>(eval, -1, false, true, small,
+                                                 big);
+    Match<board_size> m(black, white);
 
     for (int i = tid; i < games; i += num_threads) {
 
@@ -114,18 +177,26 @@ void generate_data_pcr(int num_threads, int games, int small, int big,
   for (int i = 0; i < num_threads; ++i) {
     threads[i].join();
   }
+  std::cout << nn_eval->get_batch_stats().to_string() << "\n"
+            << cache->get_cache_stats().to_string() << std::endl;
 
   fs::current_path(starting_path);
 }
 
-int test_strength(const std::string &model1_file,
-                  const std::string &model2_file, int num_threads, int games,
-                  int playouts, const std::string &save_dir) {
+template <int board_size>
+int test_strength(std::shared_ptr<torch::jit::script::Module> model1,
+                  std::shared_ptr<torch::jit::script::Module> model2,
+                  int num_threads, int games, int playouts,
+                  const std::string &save_dir, int max_batch_size) {
 
-  std::shared_ptr<Evaluator> model1_eval =
-      std::make_shared<NNEvaluator<48>>(model1_file);
-  std::shared_ptr<Evaluator> model2_eval =
-      std::make_shared<NNEvaluator<48>>(model2_file);
+  std::shared_ptr<NNEvaluator<board_size>> model1_nn_eval =
+      std::make_shared<NNEvaluator<board_size>>(std::move(model1),
+                                                max_batch_size);
+  std::shared_ptr<NNEvaluator<board_size>> model2_nn_eval =
+      std::make_shared<NNEvaluator<board_size>>(std::move(model2),
+                                                max_batch_size);
+  std::shared_ptr<Evaluator<board_size>> model1_eval = model1_nn_eval;
+  std::shared_ptr<Evaluator<board_size>> model2_eval = model2_nn_eval;
   std::shared_ptr<std::atomic<int>> win_counter =
       std::make_shared<std::atomic<int>>(0);
   std::shared_ptr<std::atomic<int>> game_counter =
@@ -135,12 +206,18 @@ int test_strength(const std::string &model1_file,
 
   auto task = [&, model1_eval, model2_eval, num_threads, win_counter,
                game_counter](int tid, int games, int playouts) {
-    std::shared_ptr<AbstractPlayer> player1 =
-        std::make_shared<MCTSPlayer>(model1_eval, playouts, true);
-    std::shared_ptr<AbstractPlayer> player2 =
-        std::make_shared<MCTSPlayer>(model2_eval, playouts, true);
-    Match m(player1, player2);
-    Match m2(player2, player1);
+    // both sides play the most visited move after the opening, which
+    // pruning finds with fewer playouts
+    std::shared_ptr<MCTSPlayer<board_size>> player1 =
+        std::make_shared<MCTSPlayer<board_size>>(
+            model1_eval, playouts, true, false, 0, 0, 1, 1, 0,
+            MCTSPruning::PRUNE_CHILDREN);
+    std::shared_ptr<MCTSPlayer<board_size>> player2 =
+        std::make_shared<MCTSPlayer<board_size>>(
+            model2_eval, playouts, true, false, 0, 0, 1, 1, 0,
+            MCTSPruning::PRUNE_CHILDREN);
+    Match<board_size> m(player1, player2);
+    Match<board_size> m2(player2, player1);
     for (int i = tid; i < games; i += num_threads) {
       float res;
       if (i % 2 == 0) {
@@ -157,6 +234,9 @@ int test_strength(const std::string &model1_file,
       std::cout << res << "; " << *win_counter << "/" << *game_counter << "; "
                 << (elapsed_seconds.count() / *game_counter) << std::endl;
     }
+    std::cout << "thread " << tid << " player 1 "
+              << player1->get_pruning_stats().to_string() << "; player 2 "
+              << player2->get_pruning_stats().to_string() << std::endl;
   };
 
   auto starting_path = fs::current_path();
@@ -170,17 +250,41 @@ int test_strength(const std::string &model1_file,
   for (int i = 0; i < num_threads; ++i) {
     threads[i].join();
   }
+  std::cout << "model 1: " << model1_nn_eval->get_batch_stats().to_string()
+            << "\nmodel 2: " << model2_nn_eval->get_batch_stats().to_string()
+            << std::endl;
   fs::current_path(starting_path);
   return *win_counter;
 }
 
-void gtp(const std::string &model_file, int playouts) {
-  std::shared_ptr<Evaluator> eval =
-      std::make_shared<NNEvaluator<1>>(model_file);
-  std::shared_ptr<AbstractPlayer> engine =
-      std::make_shared<MCTSPlayer>(eval, playouts, true);
-  GTP gtp_runner(engine);
+template <int board_size>
+void gtp(std::shared_ptr<torch::jit::script::Module> model, int playouts,
+         int search_threads, int leaf_batch_size, NNSymmetry symmetry,
+         bool ponder) {
+  // leaves from all search threads share batches
+  const int rows_per_leaf =
+      symmetry == NNSymmetry::AVERAGE ? NUM_SYMMETRIES : 1;
+  std::shared_ptr<NNEvaluator<board_size>> nn_eval =
+      std::make_shared<NNEvaluator<board_size>>(
+          std::move(model), search_threads * leaf_batch_size * rows_per_leaf,
+          symmetry);
+  // positions searched for one move come up again in the searches after it.
+  // a cached random transform would stay fixed for its position, so random
+  // symmetry goes to the network every time
+  std::shared_ptr<Evaluator<board_size>> eval = nn_eval;
+  if (symmetry != NNSymmetry::RANDOM) {
+    eval = std::make_shared<CachingEvaluator<board_size>>(
+        nn_eval, NN_CACHE_DEFAULT_ENTRIES, nn_eval->get_history_len());
+  }
+  std::shared_ptr<MCTSPlayer<board_size>> engine =
+      std::make_shared<MCTSPlayer<board_size>>(
+          eval, playouts, true, false, 0, 0, search_threads, leaf_batch_size,
+          ponder ? MCTS_PONDER_VISITS_FACTOR * playouts : 0,
+          MCTSPruning::STOP_EARLY);
+  GTP<board_size> gtp_runner(engine, ponder);
   gtp_runner.run();
+  std::cerr << engine->get_reuse_stats().to_string() << "\n"
+            << engine->get_pruning_stats().to_string() << std::endl;
 }
 
 int main(int argc, char *argv[]) {
@@ -193,20 +297,29 @@ int main(int argc, char *argv[]) {
     if (argc < 7) {
       std::cout << "generate_data usage: ./roost generate_data <model_file> "
                    "<num_games> "
-                   "<num_threads> <playouts> <save_directory>\n";
+                   "<num_threads> <playouts> <save_directory> "
+                   "[max_batch_size]\n";
       return -1;
     }
     std::string model_file = argv[2];
     int num_games = stoi(argv[3]);
     int num_threads = stoi(argv[4]);
     int num_playouts = stoi(argv[5]);
-    generate_data(num_threads, num_games, num_playouts, model_file, argv[6]);
+    // every game thread has at most one evaluation in flight
+    int max_batch_size = (argc > 7) ? stoi(argv[7]) : num_threads;
+    // loaded once, for its board size and then for the evaluator
+    auto model = load_model(model_file);
+    with_board_size(model_board_size(*model), [&](auto size) {
+      generate_data<size()>(num_threads, num_games, num_playouts, model,
+                            argv[6], max_batch_size);
+    });
     return 0;
   } else if (command == "generate_data_pcr") {
     if (argc < 8) {
       std::cout
           << "generate_data_pcr usage: ./roost generate_data <model_file> "
-             "<num_games> <num_threads> <n> <N> <save_directory>\n";
+             "<num_games> <num_threads> <n> <N> <save_directory> "
+             "[max_batch_size]\n";
       return -1;
     }
     std::string model_file = argv[2];
@@ -214,12 +327,18 @@ int main(int argc, char *argv[]) {
     int num_threads = stoi(argv[4]);
     int small = stoi(argv[5]);
     int big = stoi(argv[6]);
-    generate_data_pcr(num_threads, num_games, small, big, model_file, argv[7]);
+    int max_batch_size = (argc > 8) ? stoi(argv[8]) : num_threads;
+    auto model = load_model(model_file);
+    with_board_size(model_board_size(*model), [&](auto size) {
+      generate_data_pcr<size()>(num_threads, num_games, small, big, model,
+                                argv[7], max_batch_size);
+    });
   } else if (command == "test_strength") {
     if (argc < 7) {
       std::cout << "test_strength usage: ./roost test_strength <model_1_file> "
                    "<model_2_file> "
-                   "<num_games> <num_threads> <num_playouts>\n";
+                   "<num_games> <num_threads> <num_playouts> "
+                   "[max_batch_size]\n";
       return -1;
     }
     std::string model_1 = argv[2];
@@ -227,16 +346,41 @@ int main(int argc, char *argv[]) {
     int num_games = stoi(argv[4]);
     int num_threads = stoi(argv[5]);
     int num_playouts = stoi(argv[6]);
-    std::cout << test_strength(model_1, model_2, num_threads, num_games,
-                               num_playouts, "test_strength")
-              << std::endl;
+    int max_batch_size = (argc > 7) ? stoi(argv[7]) : num_threads;
+    auto model1 = load_model(model_1);
+    auto model2 = load_model(model_2);
+    const int board_size = model_board_size(*model1);
+    if (model_board_size(*model2) != board_size) {
+      std::cout << "test_strength: models have different board sizes\n";
+      return -1;
+    }
+    with_board_size(board_size, [&](auto size) {
+      std::cout << test_strength<size()>(model1, model2, num_threads,
+                                         num_games, num_playouts,
+                                         "test_strength", max_batch_size)
+                << std::endl;
+    });
     return 0;
   } else if (command == "gtp") {
     if (argc < 4) {
-      std::cout << "gtp usage: ./roost gtp <model_file> <playouts>\n";
+      std::cout << "gtp usage: ./roost gtp <model_file> <playouts> "
+                   "[search_threads] [leaf_batch_size] "
+                   "[none|random|average] [ponder]\n"
+                   "random symmetry skips the evaluation cache, so that "
+                   "every evaluation draws its own transform\n";
     }
     int num_playouts = stoi(argv[3]);
-    gtp(argv[2], num_playouts);
+    int search_threads = (argc > 4) ? stoi(argv[4]) : 1;
+    int leaf_batch_size = (argc > 5) ? stoi(argv[5]) : 1;
+    NNSymmetry symmetry =
+        (argc > 6) ? parse_symmetry(argv[6]) : NNSymmetry::NONE;
+    // think on the opponent's time
+    bool ponder = (argc > 7) && std::string(argv[7]) == "ponder";
+    auto model = load_model(argv[2]);
+    with_board_size(model_board_size(*model), [&](auto size) {
+      gtp<size()>(model, num_playouts, search_threads, leaf_batch_size,
+                  symmetry, ponder);
+    });
   }
   return -1;
 }
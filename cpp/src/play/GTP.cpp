@@ -5,40 +5,98 @@
 #include "play/GTP.h"
 #include "game/Action.h"
 #include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <sstream>
 #include <string>
 
-GTP::GTP(std::shared_ptr<AbstractPlayer> engine) : engine_(std::move(engine)) {}
+template <int board_size>
+GTP<board_size>::GTP(std::shared_ptr<AbstractPlayer<board_size>> engine,
+                     bool ponder)
+    : engine_(std::move(engine)), ponder_(ponder) {}
 
-void GTP::run() {
+template <int board_size> void GTP<board_size>::run() {
   try {
-    game::GameState s(7.5);
+    game::GameState<board_size> s(7.5);
     bool done = false;
     std::string input_str;
     std::string playout_log;
     while (!done) {
       std::cerr << s.to_string() << "\n";
-      getline(std::cin, input_str);
+      if (ponder_ && !s.done()) {
+        engine_->ponder(s);
+      }
+      const bool read = static_cast<bool>(getline(std::cin, input_str));
+      // every command sees the tree as the search left it
+      engine_->stop_pondering();
+      if (!read) {
+        break;
+      }
       std::cerr << "received: " << input_str << std::endl;
       std::transform(input_str.begin(), input_str.end(), input_str.begin(),
                      ::tolower);
-      if (input_str == "genmove b") {
-        if (s.get_turn() != game::BLACK) {
+      if (input_str == "genmove b" || input_str == "genmove w") {
+        const game::Color color =
+            input_str.back() == 'b' ? game::BLACK : game::WHITE;
+        if (s.get_turn() != color) {
           throw std::logic_error("invalid genmove turn");
         }
-        game::Action a = engine_->get_move(s, &playout_log);
+        engine_->set_time_budget(
+            time_control_.is_limited()
+                ? time_control_.allocate(color, s.get_num_turns())
+                : 0.0);
+        const auto start = std::chrono::steady_clock::now();
+        game::Action<board_size> a = engine_->get_move(s, &playout_log);
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        time_control_.spend(color, elapsed.count());
         std::cout << a.to_gtp_string() << "\n" << std::endl;
         std::cerr << playout_log;
         s.move(a);
-      } else if (input_str == "genmove w") {
-        if (s.get_turn() != game::WHITE) {
-          throw std::logic_error("invalid genmove turn");
+        engine_->play(a);
+      } else if (input_str.substr(0, 13) == "time_settings") {
+        std::istringstream ss(input_str.substr(13));
+        double main_time, byo_yomi_time;
+        int byo_yomi_stones;
+        if (ss >> main_time >> byo_yomi_time >> byo_yomi_stones) {
+          time_control_.set_time_settings(main_time, byo_yomi_time,
+                                          byo_yomi_stones);
+          std::cout << "=\n" << std::endl;
+        } else {
+          std::cout << "? syntax error\n" << std::endl;
+        }
+      } else if (input_str.substr(0, 17) == "kgs-time_settings") {
+        std::istringstream ss(input_str.substr(17));
+        std::string system;
+        double main_time = 0, byo_yomi_time = 0;
+        int count = 0;
+        ss >> system >> main_time >> byo_yomi_time >> count;
+        bool known = true;
+        if (system == "none") {
+          time_control_.set_unlimited();
+        } else if (system == "absolute") {
+          time_control_.set_time_settings(main_time, 0, 0);
+        } else if (system == "byoyomi") {
+          time_control_.set_byo_yomi_periods(main_time, byo_yomi_time, count);
+        } else if (system == "canadian") {
+          time_control_.set_time_settings(main_time, byo_yomi_time, count);
+        } else {
+          known = false;
+        }
+        std::cout << (known ? "=\n" : "? unknown time system\n") << std::endl;
+      } else if (input_str.substr(0, 9) == "time_left") {
+        std::istringstream ss(input_str.substr(9));
+        std::string color;
+        double time;
+        int stones;
+        if (ss >> color >> time >> stones) {
+          time_control_.set_time_left(color[0] == 'b' ? game::BLACK
+                                                      : game::WHITE,
+                                      time, stones);
+          std::cout << "=\n" << std::endl;
+        } else {
+          std::cout << "? syntax error\n" << std::endl;
         }
-        game::Action a = engine_->get_move(s, &playout_log);
-        std::cout << a.to_gtp_string() << "\n" << std::endl;
-        std::cerr << playout_log;
-        s.move(a);
       } else if (input_str.substr(0, 8) == "kgs-chat") {
 
         std::istringstream ss(input_str);
@@ -58,18 +116,24 @@ void GTP::run() {
                     << std::endl;
         }
       } else if (input_str.substr(0, 4) == "play") {
-        s.move(game::Action::from_action(input_str));
+        game::Action<board_size> a =
+            game::Action<board_size>::from_action(input_str);
+        s.move(a);
+        engine_->play(a);
         std::cout << "=\n" << std::endl;
       } else if (input_str == "final_score") {
         std::cout << ((s.score() > 0) ? "= B+0.5\n" : "= W+0.5\n") << std::endl;
       } else if (input_str == "list_commands") {
         std::cout << "= genmove\nkomi\nplay\nclear_board\nkgs-chat\n"
+                     "time_settings\ntime_left\nkgs-time_settings\n"
                   << std::endl;
       } else if (input_str == "quit") {
         done = true;
         std::cout << "=\n" << std::endl;
       } else if (input_str == "clear_board") {
-        s = game::GameState(7.5);
+        s = game::GameState<board_size>(7.5);
+        engine_->reset();
+        time_control_.reset_clocks();
         std::cout << "=\n" << std::endl;
       } else {
         std::cout << "=\n" << std::endl;
@@ -79,3 +143,7 @@ void GTP::run() {
     std::cerr << "Game crashed; error: " << e.what() << "\n";
   }
 }
+
+template class GTP<9>;
+template class GTP<13>;
+template class GTP<19>;
@@ -9,20 +9,23 @@
 #include <memory>
 #include <string>
 
-Match::Match(std::shared_ptr<AbstractPlayer> black,
-             std::shared_ptr<AbstractPlayer> white)
+template <int board_size>
+Match<board_size>::Match(std::shared_ptr<AbstractPlayer<board_size>> black,
+                         std::shared_ptr<AbstractPlayer<board_size>> white)
     : players{
           std::move(white),
           std::move(black),
       } {}
 
-float Match::run(int gameId) {
+template <int board_size> float Match<board_size>::run(int gameId) {
   int black_wins = 0;
   std::uniform_real_distribution<float> dist(0, 1);
   float random_pct = dist(gen_);
   std::string sgf_string = "(;GM[1]FF[4]CA[UTF-8]AP[CGoban:3]ST[2]\nRU[AGA]"
-                           "SZ[9]KM[7.50]\nPW[White]PB[Black]\n";
-  game::GameState state;
+                           "SZ[" +
+                           std::to_string(board_size) +
+                           "]KM[7.50]\nPW[White]PB[Black]\n";
+  game::GameState<board_size> state;
   std::string temp_string;
   int black_resign_moves = 0;
   int white_resign_moves = 0;
@@ -34,9 +37,10 @@ float Match::run(int gameId) {
     if ((black_resign_moves >= RESIGN_CONSECUTIVE_MOVES ||
          white_resign_moves >= RESIGN_CONSECUTIVE_MOVES) &&
         random_pct > NORESIGN_PCT) {
-      state.move(game::Action(turn, game::RESIGN));
+      state.move(game::Action<board_size>(turn, game::RESIGN));
     } else {
-      game::Action move = players[turn_index]->get_move(state, &temp_string);
+      game::Action<board_size> move =
+          players[turn_index]->get_move(state, &temp_string);
       float winrate = players[turn_index]->get_wr(state);
       if (winrate > (1.0 - RESIGN_THRESHOLD)) {
         ++white_resign_moves;
@@ -52,6 +56,16 @@ float Match::run(int gameId) {
       sgf_string += move.to_sgf_string() + temp_string;
     }
   }
+  // final area ownership as one B/W/. per point in row-major order, for use
+  // as an auxiliary training target. XO is a private property, since FF[4]
+  // already defines OW as white's remaining time
+  game::Color ownership[board_size * board_size];
+  state.get_ownership(ownership);
+  sgf_string += "XO[";
+  for (game::Color c : ownership) {
+    sgf_string += (c == game::BLACK) ? 'B' : (c == game::WHITE) ? 'W' : '.';
+  }
+  sgf_string += "]\n";
   if (state.winner() == game::BLACK) {
     ++black_wins;
     sgf_string += "RE[B+R])";
@@ -67,3 +81,7 @@ float Match::run(int gameId) {
 
   return state.score();
 }
+
+template class Match<9>;
+template class Match<13>;
+template class Match<19>;
@@ -0,0 +1,143 @@
+//
+// Created by Jeremy on 3/13/2022.
+//
+
+#include "play/TimeControl.h"
+#include <algorithm>
+
+template <int board_size>
+TimeControl<board_size>::TimeControl()
+    : limited_(false), japanese_(false), main_time_(0), byo_yomi_time_(0),
+      byo_yomi_stones_(0), byo_yomi_periods_(0) {
+  reset_clocks();
+}
+
+template <int board_size>
+void TimeControl<board_size>::set_time_settings(double main_time,
+                                                double byo_yomi_time,
+                                                int byo_yomi_stones) {
+  // byo-yomi time without stones, or no time at all, means no time limit
+  limited_ = (byo_yomi_stones > 0 || byo_yomi_time <= 0) &&
+             (main_time > 0 || byo_yomi_time > 0);
+  japanese_ = false;
+  main_time_ = main_time;
+  byo_yomi_time_ = byo_yomi_time;
+  byo_yomi_stones_ = byo_yomi_stones;
+  byo_yomi_periods_ = 0;
+  reset_clocks();
+}
+
+template <int board_size>
+void TimeControl<board_size>::set_byo_yomi_periods(double main_time,
+                                                   double period_time,
+                                                   int periods) {
+  limited_ = true;
+  japanese_ = true;
+  main_time_ = main_time;
+  byo_yomi_time_ = period_time;
+  byo_yomi_stones_ = 1;
+  byo_yomi_periods_ = periods;
+  reset_clocks();
+}
+
+template <int board_size> void TimeControl<board_size>::set_unlimited() {
+  limited_ = false;
+  reset_clocks();
+}
+
+template <int board_size>
+void TimeControl<board_size>::set_time_left(game::Color color, double time,
+                                            int stones) {
+  Clock &clock = clocks_[color_index_(color)];
+  if (stones == 0) {
+    clock.main_left = time;
+    clock.period_left = byo_yomi_time_;
+    clock.stones_left = byo_yomi_stones_;
+    clock.periods_left = byo_yomi_periods_;
+  } else {
+    clock.main_left = 0;
+    clock.period_left = time;
+    clock.stones_left = japanese_ ? 1 : stones;
+    if (japanese_) {
+      clock.periods_left = stones;
+    }
+  }
+}
+
+template <int board_size> void TimeControl<board_size>::reset_clocks() {
+  for (Clock &clock : clocks_) {
+    clock.main_left = main_time_;
+    clock.period_left = byo_yomi_time_;
+    clock.stones_left = byo_yomi_stones_;
+    clock.periods_left = byo_yomi_periods_;
+  }
+}
+
+template <int board_size>
+void TimeControl<board_size>::spend(game::Color color, double seconds) {
+  Clock &clock = clocks_[color_index_(color)];
+  if (clock.main_left >= seconds) {
+    clock.main_left -= seconds;
+    return;
+  }
+  seconds -= clock.main_left;
+  clock.main_left = 0;
+  if (byo_yomi_time_ <= 0) {
+    return;
+  }
+  if (japanese_) {
+    // a move within its period keeps the period; each overrun loses one
+    while (seconds > byo_yomi_time_ && clock.periods_left > 1) {
+      seconds -= byo_yomi_time_;
+      --clock.periods_left;
+    }
+    clock.period_left = byo_yomi_time_;
+    return;
+  }
+  clock.period_left = std::max(clock.period_left - seconds, 0.0);
+  if (--clock.stones_left <= 0) {
+    clock.period_left = byo_yomi_time_;
+    clock.stones_left = byo_yomi_stones_;
+  }
+}
+
+template <int board_size> bool TimeControl<board_size>::is_limited() const {
+  return limited_;
+}
+
+template <int board_size>
+double TimeControl<board_size>::allocate(game::Color color,
+                                         int move_num) const {
+  const Clock &clock = clocks_[color_index_(color)];
+  const int moves_left =
+      std::max(TIME_MIN_MOVES_LEFT,
+               (TIME_EXPECTED_GAME_LENGTH(board_size) - move_num) / 2);
+  double budget = clock.main_left / moves_left;
+  if (move_num < board_size) {
+    budget *= TIME_OPENING_FACTOR;
+  }
+  // byo-yomi time comes with every move, whether or not main time is left;
+  // a move may also run into a period it has not started yet
+  double period = 0;
+  if (byo_yomi_time_ > 0) {
+    if (japanese_ || clock.main_left > 0) {
+      period = byo_yomi_time_;
+      budget += TIME_BYO_YOMI_FACTOR * byo_yomi_time_ / byo_yomi_stones_;
+    } else {
+      period = clock.period_left;
+      budget += TIME_BYO_YOMI_FACTOR * clock.period_left /
+                std::max(clock.stones_left, 1);
+    }
+  }
+  const double available = clock.main_left + period - TIME_LAG_SECONDS;
+  return std::max(std::min(budget, available), TIME_MIN_MOVE_SECONDS);
+}
+
+template <int board_size>
+int TimeControl<board_size>::color_index_(game::Color color) {
+  return color == game::BLACK ? 0 : 1;
+}
+
+template class TimeControl<9>;
+template class TimeControl<13>;
+template class TimeControl<19>;
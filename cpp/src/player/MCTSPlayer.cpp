@@ -6,183 +6,870 @@
 #include "player/MCTS_defs.h"
 #include <cassert>
 #include <chrono>
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <numeric>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include <sstream>
+#include <thread>
 
-MCTSPlayer::MCTSPlayer(std::shared_ptr<Evaluator> evaluator, int playouts,
-                       bool eval_mode, bool use_pcr, int pcr_small, int pcr_big)
-    : AbstractPlayer(), evaluator_(std::move(evaluator)), gen_(rd_()),
+template <int board_size>
+MCTSPlayer<board_size>::MCTSPlayer(
+    std::shared_ptr<Evaluator<board_size>> evaluator, int playouts,
+    bool eval_mode, bool use_pcr, int pcr_small, int pcr_big,
+    int search_threads, int leaf_batch_size, int ponder_visits,
+    MCTSPruning pruning)
+    : AbstractPlayer<board_size>(), evaluator_(std::move(evaluator)),
+      // every playout adds at most one node, plus one for the root
+      max_nodes_(static_cast<int>(std::max({playouts, pcr_small, pcr_big,
+                                            ponder_visits, 0}) *
+                                  (1 + MCTS_ARENA_SLACK)) +
+                 1),
+      nodes_(std::make_unique<MCTSNode[]>(max_nodes_)),
+      edges_(max_nodes_), num_nodes_(0), num_edges_(0),
+      spare_nodes_(std::make_unique<MCTSNode[]>(max_nodes_)),
+      transpositions_(0), root_(-1), root_noised_(false),
+      reuse_stats_{0, 0, 0, 0},
+      pruning_stats_{0, 0}, gen_(rd_()),
       playouts_(playouts), eval_mode_(eval_mode), use_pcr_(use_pcr),
-      pcr_small_(pcr_small), pcr_big_(pcr_big), eval_time_(0) {}
+      pcr_small_(pcr_small), pcr_big_(pcr_big),
+      search_threads_(std::max(search_threads, 1)),
+      leaf_batch_size_(std::max(leaf_batch_size, 1)),
+      ponder_visits_(std::max(ponder_visits, 0)), time_budget_(0),
+      pruning_(pruning), root_prune_below_(0), stop_search_(false),
+      eval_time_(0) {
+  size_t table_size = 1;
+  while (table_size <
+         static_cast<size_t>(max_nodes_) * MCTS_TABLE_SLOTS_PER_NODE) {
+    table_size *= 2;
+  }
+  table_mask_ = table_size - 1;
+  table_ = std::make_unique<TableSlot[]>(table_size);
+  clear_table_();
+}
 
-game::Action MCTSPlayer::get_move(game::GameState state,
-                                  std::string *playout_log) {
+template <int board_size> MCTSPlayer<board_size>::~MCTSPlayer() {
+  stop_pondering();
+}
+
+template <int board_size>
+game::Action<board_size>
+MCTSPlayer<board_size>::get_move(game::GameState<board_size> state,
+                                 std::string *playout_log) {
   if (state.done()) {
     throw std::logic_error("get_move called on finished game\n");
   }
-  visit(state);
+  stop_pondering();
+  // the budget includes evaluating a new root
+  auto deadline = std::chrono::steady_clock::time_point::max();
+  if (time_budget_ > 0) {
+    deadline = std::chrono::steady_clock::now() +
+               std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                   std::chrono::duration<double>(time_budget_));
+  }
+  // searches stop once the root has the target number of visits, counting
+  // the reused ones
+  int target_visits = playouts_;
+  bool noise = true;
   if (!eval_mode_ && use_pcr_) {
     std::uniform_real_distribution<float> dist(0.0, 1.0);
     if (dist(gen_) < PCR_P) {
       // perform a full search
-      apply_dirichlet_noise_(state);
-      for (int i = 1; i < pcr_big_; ++i) {
-        visit(state);
-      }
+      target_visits = pcr_big_;
     } else {
       // quick search; no dirichlet noise
-      for (int i = 1; i < pcr_small_; ++i) {
-        visit(state);
-      }
-    }
-  } else {
-    apply_dirichlet_noise_(state);
-    for (int i = 1; i < playouts_; ++i) {
-      visit(state);
+      target_visits = pcr_small_;
+      noise = false;
     }
   }
+  // a logged search is a training target: visits reused from earlier
+  // searches would count towards it, and let a quick PCR search pass for a
+  // full one
+  if (playout_log != nullptr) {
+    clear_tree_();
+  }
+  int reused_visits = 0;
+  if (prepare_root_(state, target_visits)) {
+    reused_visits = nodes_[0].N;
+    ++reuse_stats_.reused_searches_;
+  }
+  if (noise && !root_noised_) {
+    apply_dirichlet_noise_(0);
+    root_noised_ = true;
+  }
+  // not sure how randommness is achieved in AGZ for eval games, so I keep
+  // temp = 1 for first 10 moves in eval games and first 20 moves in self-play
+  // games (30 in 19x19 AGZ)
+  const bool sample =
+      (!eval_mode_ || state.get_num_turns() < TEMP_0_MOVE_NUM_VAL) &&
+      state.get_num_turns() < TEMP_0_MOVE_NUM_TRAIN;
+  // a sampled move depends on every visit, not just on the most visited
+  const bool timed = time_budget_ > 0;
+  search_(state, target_visits - nodes_[0].N,
+          !sample && (timed || pruning_ != MCTSPruning::NONE), deadline);
+  if (!timed && nodes_[0].N < target_visits) {
+    ++pruning_stats_.stopped_searches_;
+    pruning_stats_.saved_playouts_ += target_visits - nodes_[0].N;
+  }
+  ++reuse_stats_.searches_;
+  reuse_stats_.reused_visits_ += reused_visits;
+  reuse_stats_.total_visits_ += nodes_[0].N;
+  const int first_root_edge = nodes_[0].first_edge;
+  const int *root_actions = &edges_.action_idx(first_root_edge);
+  const std::atomic<int> *root_N = &edges_.N(first_root_edge);
+  const int num_root_edges = nodes_[0].num_edges;
   if (playout_log != nullptr) {
     *playout_log = "C[";
-    for (int legal_idx : *(state.get_legal_action_indexes())) {
-      if (!map_.contains(state)) {
-        throw std::logic_error("map_ does not contain state");
-      }
-      if (map_[state].N[legal_idx] > 0) {
-        *playout_log += std::to_string(legal_idx) + ' ' +
-                        std::to_string(map_[state].N[legal_idx]) + ",";
+    for (int i = 0; i < num_root_edges; ++i) {
+      if (root_N[i] > 0) {
+        *playout_log += std::to_string(root_actions[i]) + ' ' +
+                        std::to_string(root_N[i].load()) + ",";
       }
     }
     *playout_log += "]\n";
   }
 
-  // not sure how randommness is achieved in AGZ for eval games, so I keep
-  // temp = 1 for first 10 moves in eval games and first 20 moves in self-play
-  // games (30 in 19x19 AGZ)
-  if ((!eval_mode_ || state.get_num_turns() < TEMP_0_MOVE_NUM_VAL) &&
-      state.get_num_turns() < TEMP_0_MOVE_NUM_TRAIN) {
-    std::uniform_int_distribution<> dist(
-        1, std::accumulate(map_[state].N.begin(), map_[state].N.end(), 0));
+  if (sample) {
+    int total_visits = 0;
+    for (int i = 0; i < num_root_edges; ++i) {
+      total_visits += root_N[i];
+    }
+    std::uniform_int_distribution<> dist(1, total_visits);
     int vis_num = dist(gen_);
     int counter = 0;
-    for (int legal_idx : *(state.get_legal_action_indexes())) {
-      counter += map_[state].N[legal_idx];
+    for (int i = 0; i < num_root_edges; ++i) {
+      counter += root_N[i];
       if (counter >= vis_num) {
-        assert(0 <= legal_idx && legal_idx <= BOARD_SIZE * BOARD_SIZE + 1);
+        const int legal_idx = root_actions[i];
+        assert(0 <= legal_idx && legal_idx <= board_size * board_size + 1);
         return {state.get_turn(), legal_idx};
       }
     }
   }
   int best_action_idx = -1;
   int max_visits = -1;
-  for (int legal_idx : *(state.get_legal_action_indexes())) {
-    if (map_[state].N[legal_idx] > max_visits) {
-      best_action_idx = legal_idx;
-      max_visits = map_[state].N[legal_idx];
+  for (int i = 0; i < num_root_edges; ++i) {
+    if (root_N[i] > max_visits) {
+      best_action_idx = root_actions[i];
+      max_visits = root_N[i];
     }
   }
-  if (best_action_idx < 0 || best_action_idx > BOARD_SIZE * BOARD_SIZE) {
+  if (best_action_idx < 0 || best_action_idx > board_size * board_size) {
     throw std::logic_error("invalid best action chosen");
   }
-  std::erase_if(map_, [&state](const auto &item) {
-    auto const &[map_state, info] = item;
-    return map_state.get_num_turns() <= state.get_num_turns();
-  });
   return {state.get_turn(), best_action_idx};
 }
 
-game::Action MCTSPlayer::get_move(game::GameState state) {
+template <int board_size>
+game::Action<board_size>
+MCTSPlayer<board_size>::get_move(game::GameState<board_size> state) {
   return get_move(std::move(state), nullptr);
 }
 
-float MCTSPlayer::get_wr(game::GameState state) {
-  return (map_[state].Qs + 1) / 2;
+template <int board_size>
+float MCTSPlayer<board_size>::get_wr(game::GameState<board_size> state) {
+  stop_pondering();
+  // only the root's position is known
+  if (!is_root_(state)) {
+    return 0.5f;
+  }
+  return (nodes_[root_].W / nodes_[root_].N + 1) / 2;
 }
 
-void MCTSPlayer::reset() { map_.clear(); }
+template <int board_size>
+void MCTSPlayer<board_size>::play(game::Action<board_size> action) {
+  stop_pondering();
+  if (root_ < 0) {
+    return;
+  }
+  // is_legal_action would report a wrong turn on stdout, which is the
+  // protocol channel in GTP mode
+  if (action.get_type() == game::RESIGN || root_state_.done() ||
+      action.get_color() != root_state_.get_turn() ||
+      !root_state_.is_legal_action(action)) {
+    // the game is over, or went on without us
+    clear_tree_();
+    return;
+  }
+  int child = UNEXPANDED;
+  const int first_edge = nodes_[root_].first_edge;
+  const int last_edge = first_edge + nodes_[root_].num_edges;
+  for (int e = first_edge; e < last_edge; ++e) {
+    if (edges_.action_idx(e) == action.get_index()) {
+      child = edges_.child(e).load(std::memory_order_relaxed);
+      break;
+    }
+  }
+  if (child < 0) {
+    // never searched, or the game ended
+    clear_tree_();
+    return;
+  }
+  // the rest of the tree stays in the arenas until the next search
+  root_ = child;
+  root_state_.move(action);
+  root_noised_ = false;
+}
 
-double MCTSPlayer::get_eval_time() { return eval_time_; }
+template <int board_size>
+void MCTSPlayer<board_size>::ponder(game::GameState<board_size> state) {
+  stop_pondering();
+  if (ponder_visits_ == 0 || state.done()) {
+    return;
+  }
+  ponder_thread_ = std::thread([this, state]() {
+    prepare_root_(state, ponder_visits_);
+    search_(state, ponder_visits_ - nodes_[0].N);
+  });
+}
 
-float MCTSPlayer::visit(const game::GameState &state) {
-  if (state.done()) {
-    return (state.winner() == game::BLACK ? 1.0f : -1.0f);
+template <int board_size> void MCTSPlayer<board_size>::stop_pondering() {
+  if (!ponder_thread_.joinable()) {
+    return;
   }
-  // if never visited, expand
-  if (!map_.contains(state)) {
-    // initialize everything to 0
-    map_[state].N.assign(BOARD_SIZE * BOARD_SIZE + 1, 0);
-    map_[state].Q.assign(BOARD_SIZE * BOARD_SIZE + 1, 0.0f);
+  stop_search_ = true;
+  ponder_thread_.join();
+  stop_search_ = false;
+}
 
-    auto start = std::chrono::system_clock::now();
-    Evaluator::Evaluation eval = evaluator_->Evaluate(state);
-    auto end = std::chrono::system_clock::now();
-    std::chrono::duration<double> elapsed_seconds = end - start;
-    eval_time_ += elapsed_seconds.count();
+template <int board_size>
+void MCTSPlayer<board_size>::set_time_budget(double seconds) {
+  time_budget_ = std::max(seconds, 0.0);
+}
 
-    // cache our policy and value
-    map_[state].P = eval.policy_;
-    map_[state].Ns = 1;
-    map_[state].Qs = eval.value_;
-    assert(map_[state].P.size() == BOARD_SIZE * BOARD_SIZE + 1);
+template <int board_size> void MCTSPlayer<board_size>::reset() {
+  stop_pondering();
+  clear_tree_();
+}
+
+template <int board_size> void MCTSPlayer<board_size>::clear_tree_() {
+  num_nodes_ = 0;
+  num_edges_ = 0;
+  root_ = -1;
+  root_noised_ = false;
+  clear_table_();
+}
 
-    return eval.value_;
+template <int board_size> void MCTSPlayer<board_size>::clear_table_() {
+  for (size_t i = 0; i <= table_mask_; ++i) {
+    table_[i].key.store(0, std::memory_order_relaxed);
+    table_[i].node.store(EXPANDING, std::memory_order_relaxed);
   }
-  // TODO: rewrite MCTS to handle transpositions
-  float max_u = -100000000.0f;
-  int best_action_idx = -1;
-  // precompute sqrt(sum_a N(s, a)) term for all items
-  float sqrt_term = std::sqrt(map_[state].Ns);
+}
+
+template <int board_size> double MCTSPlayer<board_size>::get_eval_time() {
+  return eval_time_;
+}
+
+template <int board_size>
+typename MCTSPlayer<board_size>::ReuseStats
+MCTSPlayer<board_size>::get_reuse_stats() const {
+  return reuse_stats_;
+}
+
+template <int board_size>
+typename MCTSPlayer<board_size>::PruningStats
+MCTSPlayer<board_size>::get_pruning_stats() const {
+  return pruning_stats_;
+}
+
+template <int board_size>
+uint64_t MCTSPlayer<board_size>::get_transpositions() const {
+  return transpositions_.load(std::memory_order_relaxed);
+}
+
+template <int board_size>
+std::string MCTSPlayer<board_size>::PruningStats::to_string() const {
+  std::stringstream ss;
+  ss << "searches stopped early: " << stopped_searches_
+     << ", playouts saved: " << saved_playouts_;
+  return ss.str();
+}
+
+template <int board_size>
+std::string MCTSPlayer<board_size>::ReuseStats::to_string() const {
+  std::stringstream ss;
+  ss << "searches: " << searches_ << ", reused trees: " << reused_searches_
+     << ", reused visits: " << reused_visits_ << "/" << total_visits_;
+  return ss.str();
+}
+
+template <int board_size>
+bool MCTSPlayer<board_size>::prepare_root_(
+    const game::GameState<board_size> &state, int target_visits) {
+  if (is_root_(state)) {
+    // continue from the subgraph left by earlier searches and play()
+    if (root_ != 0) {
+      compact_();
+    }
+    if (num_nodes_ + std::max(target_visits - nodes_[0].N, 0) <=
+        max_nodes_) {
+      return true;
+    }
+  }
+  // start a fresh tree; the first playout expands the root
+  clear_tree_();
+  typename Evaluator<board_size>::Evaluation root_eval;
+  evaluate_({&state}, &root_eval);
+  add_node_(state, root_eval);
+  int slot;
+  find_or_claim_(nodes_[0].key, &slot);
+  table_[slot].node.store(0, std::memory_order_relaxed);
+  root_ = 0;
+  root_state_ = state;
+  return false;
+}
+
+template <int board_size>
+bool MCTSPlayer<board_size>::is_root_(
+    const game::GameState<board_size> &state) const {
+  // the turn count and every history board together identify the position
+  // of one game closely enough; play() keeps root_state_ in step with it
+  return root_ >= 0 && !state.done() &&
+         state.get_num_turns() == root_state_.get_num_turns() &&
+         state.history_hash(GAME_HISTORY_LEN) ==
+             root_state_.history_hash(GAME_HISTORY_LEN);
+}
+
+template <int board_size> void MCTSPlayer<board_size>::compact_() {
+  // breadth first from the root; a node's new index is its place in order,
+  // and a node with several parents is copied once. the edges go to fresh
+  // blocks, only as many as the kept tree needs
+  MCTSEdges edges(max_nodes_);
+  std::vector<int> order = {root_};
+  std::vector<int> new_index(num_nodes_.load(), -1);
+  new_index[root_] = 0;
+  int num_edges = 0;
+  for (size_t i = 0; i < order.size(); ++i) {
+    const MCTSNode &old_node = nodes_[order[i]];
+    MCTSNode &node = spare_nodes_[i];
+    node.key = old_node.key;
+    num_edges = MCTSEdges::place(num_edges, old_node.num_edges);
+    if (old_node.num_edges > 0) {
+      edges.allocate(num_edges);
+    }
+    node.first_edge = num_edges;
+    node.num_edges = old_node.num_edges;
+    node.N.store(old_node.N.load(std::memory_order_relaxed),
+                 std::memory_order_relaxed);
+    node.W.store(old_node.W.load(std::memory_order_relaxed),
+                 std::memory_order_relaxed);
+    for (int e = 0; e < old_node.num_edges; ++e) {
+      const int old_edge = old_node.first_edge + e;
+      const int edge = num_edges++;
+      edges.action_idx(edge) = edges_.action_idx(old_edge);
+      edges.P(edge) = edges_.P(old_edge);
+      edges.N(edge).store(
+          edges_.N(old_edge).load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+      edges.W(edge).store(
+          edges_.W(old_edge).load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+      int child = edges_.child(old_edge).load(std::memory_order_relaxed);
+      if (child >= 0) {
+        if (new_index[child] < 0) {
+          new_index[child] = static_cast<int>(order.size());
+          order.push_back(child);
+        }
+        child = new_index[child];
+      }
+      edges.child(edge).store(child, std::memory_order_relaxed);
+    }
+  }
+  std::swap(nodes_, spare_nodes_);
+  edges_ = std::move(edges);
+  num_nodes_ = static_cast<int>(order.size());
+  num_edges_ = num_edges;
+  root_ = 0;
+  clear_table_();
+  for (size_t i = 0; i < order.size(); ++i) {
+    int slot;
+    if (find_or_claim_(nodes_[i].key, &slot) == UNEXPANDED && slot >= 0) {
+      table_[slot].node.store(static_cast<int>(i), std::memory_order_relaxed);
+    }
+  }
+}
+
+template <int board_size>
+void MCTSPlayer<board_size>::evaluate_(
+    const std::vector<const game::GameState<board_size> *> &states,
+    typename Evaluator<board_size>::Evaluation *evaluations) {
+  auto start = std::chrono::system_clock::now();
+  // single evaluations go through Evaluate so that evaluators batching
+  // across threads still see them
+  if (states.size() == 1) {
+    evaluations[0] = evaluator_->Evaluate(*states[0]);
+  } else {
+    evaluator_->EvaluateBatch(states, evaluations);
+  }
+  auto end = std::chrono::system_clock::now();
+  std::chrono::duration<double> elapsed_seconds = end - start;
+  eval_time_ += elapsed_seconds.count();
+}
+
+template <int board_size>
+int MCTSPlayer<board_size>::add_node_(
+    const game::GameState<board_size> &state,
+    const typename Evaluator<board_size>::Evaluation &eval) {
+  // cache our policy and value; only legal moves get an edge
+  const std::span<const int> legal_actions = state.get_legal_action_indexes();
+  const int num_edges = static_cast<int>(legal_actions.size());
+  const int node = num_nodes_.fetch_add(1);
+  int size = num_edges_.load(std::memory_order_relaxed);
+  int first_edge;
+  do {
+    first_edge = MCTSEdges::place(size, num_edges);
+  } while (!num_edges_.compare_exchange_weak(size, first_edge + num_edges));
+  assert(node < max_nodes_);
+  if (num_edges > 0) {
+    edges_.allocate(first_edge);
+  }
+  nodes_[node].key = key_(state);
+  nodes_[node].first_edge = first_edge;
+  nodes_[node].num_edges = num_edges;
+  nodes_[node].N.store(1, std::memory_order_relaxed);
+  nodes_[node].W.store(eval.value_, std::memory_order_relaxed);
+  for (int i = 0; i < num_edges; ++i) {
+    const int edge = first_edge + i;
+    edges_.action_idx(edge) = legal_actions[i];
+    edges_.P(edge) = eval.policy_[legal_actions[i]];
+    edges_.child(edge).store(UNEXPANDED, std::memory_order_relaxed);
+    edges_.N(edge).store(0, std::memory_order_relaxed);
+    edges_.W(edge).store(0.0f, std::memory_order_relaxed);
+  }
+  return node;
+}
+
+template <int board_size>
+uint64_t MCTSPlayer<board_size>::key_(const game::GameState<board_size> &state) {
+  // the move number keeps a position from meeting itself later in a line,
+  // and passes decide whether the next pass ends the game
+  const uint64_t key =
+      state.hash() ^ (static_cast<uint64_t>(state.get_num_turns()) * 2 +
+                      state.get_passes() + 1) *
+                         0x9E3779B97F4A7C15ULL;
+  return key == 0 ? 1 : key;
+}
+
+template <int board_size>
+int MCTSPlayer<board_size>::find_or_claim_(uint64_t key, int *slot) {
+  *slot = -1;
+  for (int i = 0; i < MCTS_TABLE_PROBES; ++i) {
+    const size_t index = (key + i) & table_mask_;
+    uint64_t slot_key = table_[index].key.load(std::memory_order_acquire);
+    if (slot_key == 0 && table_[index].key.compare_exchange_strong(
+                             slot_key, key, std::memory_order_acq_rel)) {
+      *slot = static_cast<int>(index);
+      return UNEXPANDED;
+    }
+    // a failed exchange leaves the key another thread just claimed the slot
+    // for in slot_key
+    if (slot_key == key) {
+      return table_[index].node.load(std::memory_order_acquire);
+    }
+  }
+  return UNEXPANDED;
+}
+
+template <int board_size>
+bool MCTSPlayer<board_size>::same_moves_(
+    int node, const game::GameState<board_size> &state) const {
+  const std::span<const int> legal_actions = state.get_legal_action_indexes();
+  if (static_cast<int>(legal_actions.size()) != nodes_[node].num_edges) {
+    return false;
+  }
+  const int *actions = &edges_.action_idx(nodes_[node].first_edge);
+  for (size_t i = 0; i < legal_actions.size(); ++i) {
+    if (actions[i] != legal_actions[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <int board_size>
+void MCTSPlayer<board_size>::search_(
+    const game::GameState<board_size> &state, int num_playouts,
+    bool stop_when_decided, std::chrono::steady_clock::time_point deadline) {
+  const auto start = std::chrono::steady_clock::now();
+  // every playout adds at most one node. a reused graph can hold more nodes
+  // than its root has visits, reached through parents that were dropped, so
+  // a search may have to stop short of its target
+  num_playouts = std::min(num_playouts, max_nodes_ - num_nodes_.load());
+  std::atomic<int> remaining(num_playouts);
+  root_prune_below_ = 0;
+  // set by the first thread to find the search decided or out of time
+  std::atomic<bool> stop(false);
+  auto stopped = [this, &stop]() {
+    return stop.load(std::memory_order_relaxed) ||
+           stop_search_.load(std::memory_order_relaxed);
+  };
+  // takes one playout if any are left. remaining never drops below 0, so a
+  // playout given back after a collision is always run by someone
+  auto claim = [&remaining]() {
+    int left = remaining.load();
+    while (left > 0 && !remaining.compare_exchange_weak(left, left - 1)) {
+    }
+    return left > 0;
+  };
+  auto task = [this, &state, num_playouts, stop_when_decided, deadline, start,
+               &remaining, &stop, &stopped, &claim]() {
+    std::vector<Leaf> leaves(leaf_batch_size_);
+    std::vector<typename Evaluator<board_size>::Evaluation> evals(
+        leaf_batch_size_);
+    std::vector<const game::GameState<board_size> *> leaf_states;
+    leaf_states.reserve(leaf_batch_size_);
+    // playouts descend on one state per thread and take their moves back
+    // afterwards. a leaf to evaluate keeps the state until the next playout
+    // needs it, and only then gets a copy; with batches of one, no state is
+    // copied at all
+    game::GameState<board_size> scratch = state;
+    std::vector<Undo> undos(MAX_GAME_LENGTH(board_size));
+    auto take_back = [&scratch, &undos](const Path &path) {
+      for (int i = path.size() - 1; i >= 0; --i) {
+        scratch.undo_move(undos[i]);
+      }
+    };
+    while (true) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        stop = true;
+      } else if (stop_when_decided && !stopped()) {
+        const int left = remaining.load();
+        const double expected =
+            expected_playouts_(num_playouts - left, left, start, deadline);
+        const auto [best, second] = root_leaders_();
+        if (best - second > expected) {
+          stop = true;
+        } else if (pruning_ == MCTSPruning::PRUNE_CHILDREN) {
+          // even every playout left could not lift these above the best
+          root_prune_below_.store(static_cast<int>(best - expected),
+                                  std::memory_order_relaxed);
+        }
+      }
+      leaf_states.clear();
+      // the leaf whose position scratch holds, if any
+      Leaf *in_scratch = nullptr;
+      while (static_cast<int>(leaf_states.size()) < leaf_batch_size_ &&
+             !stopped() && claim()) {
+        if (in_scratch != nullptr) {
+          in_scratch->state = scratch;
+          leaf_states.back() = &in_scratch->state;
+          take_back(in_scratch->path);
+          in_scratch = nullptr;
+        }
+        Leaf &leaf = leaves[leaf_states.size()];
+        LeafType type = select_(&scratch, undos.data(), &leaf);
+        if (type == LeafType::EXPAND) {
+          leaf_states.push_back(&scratch);
+          in_scratch = &leaf;
+          continue;
+        }
+        take_back(leaf.path);
+        if (type == LeafType::TERMINAL) {
+          backup_(leaf.path, leaf.value);
+        } else {
+          // give the playout back and evaluate what we have; the leaves in
+          // flight are probably the only ones left nearby
+          ++remaining;
+          break;
+        }
+      }
+      if (leaf_states.empty()) {
+        if (remaining <= 0 || stopped()) {
+          return;
+        }
+        // wait for other threads to finish expanding
+        std::this_thread::yield();
+        continue;
+      }
+      evaluate_(leaf_states, evals.data());
+      for (size_t i = 0; i < leaf_states.size(); ++i) {
+        const int child = add_node_(*leaf_states[i], evals[i]);
+        if (leaves[i].slot >= 0) {
+          table_[leaves[i].slot].node.store(child, std::memory_order_release);
+        }
+        edges_.child(leaves[i].path.back().edge).store(
+            child, std::memory_order_release);
+        backup_(leaves[i].path, evals[i].value_);
+      }
+      if (in_scratch != nullptr) {
+        take_back(in_scratch->path);
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(search_threads_ - 1);
+  for (int i = 1; i < search_threads_; ++i) {
+    threads.emplace_back(task);
+  }
+  task();
+  for (std::thread &t : threads) {
+    t.join();
+  }
+}
+
+template <int board_size>
+double MCTSPlayer<board_size>::expected_playouts_(
+    int playouts_done, int playouts_left,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point deadline) {
+  if (deadline == std::chrono::steady_clock::time_point::max() ||
+      playouts_done <= 0) {
+    return playouts_left;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  const std::chrono::duration<double> elapsed = now - start;
+  const std::chrono::duration<double> left = deadline - now;
+  return std::min(static_cast<double>(playouts_left),
+                  playouts_done * left.count() / elapsed.count());
+}
+
+template <int board_size>
+std::pair<int, int> MCTSPlayer<board_size>::root_leaders_() const {
+  int best = 0;
+  int second = 0;
+  const int first_edge = nodes_[0].first_edge;
+  const int last_edge = first_edge + nodes_[0].num_edges;
+  for (int e = first_edge; e < last_edge; ++e) {
+    const int n = edges_.N(e).load(std::memory_order_relaxed);
+    if (n > best) {
+      second = best;
+      best = n;
+    } else if (n > second) {
+      second = n;
+    }
+  }
+  return {best, second};
+}
+
+template <int board_size>
+typename MCTSPlayer<board_size>::LeafType
+MCTSPlayer<board_size>::select_(game::GameState<board_size> *state,
+                                Undo *undos, Leaf *leaf) {
+  leaf->path.clear();
+  leaf->slot = -1;
+  int node = 0;
+  while (true) {
+    const game::Color turn = state->get_turn();
+    const int e = select_edge_(node, turn);
+    const game::Action<board_size> action(turn, edges_.action_idx(e));
+    if (!state->is_legal_action(action)) {
+      // superko forbids the move on this path into a shared node
+      leaf->value = nodes_[node].W / nodes_[node].N;
+      return LeafType::TERMINAL;
+    }
+    // count the playout as MCTS_VIRTUAL_LOSS lost visits until it is backed
+    // up, on the edge and on the node it leaves (but not the root); values
+    // are from black's perspective
+    const float virtual_loss =
+        (turn == game::BLACK ? -1.0f : 1.0f) * MCTS_VIRTUAL_LOSS;
+    edges_.N(e) += MCTS_VIRTUAL_LOSS;
+    edges_.W(e) += virtual_loss;
+    if (!leaf->path.empty()) {
+      nodes_[node].N += MCTS_VIRTUAL_LOSS;
+      nodes_[node].W -= virtual_loss;
+    }
+    state->move(action, &undos[leaf->path.size()]);
+    leaf->path.push_back({node, e, virtual_loss});
+    if (state->done()) {
+      // finished positions get no node; the edge keeps the result itself
+      leaf->value = (state->winner() == game::BLACK ? 1.0f : -1.0f);
+      return LeafType::TERMINAL;
+    }
+    int child = edges_.child(e).load(std::memory_order_acquire);
+    if (child == UNEXPANDED &&
+        edges_.child(e).compare_exchange_strong(child, EXPANDING)) {
+      // the position may already be in the tree by another move order
+      child = find_or_claim_(key_(*state), &leaf->slot);
+      if (child == UNEXPANDED) {
+        return LeafType::EXPAND;
+      }
+      if (child >= 0 && !same_moves_(child, *state)) {
+        // superko differs; the position gets a node of its own
+        return LeafType::EXPAND;
+      }
+      if (child >= 0) {
+        ++transpositions_;
+      }
+      edges_.child(e).store(child == EXPANDING ? UNEXPANDED : child,
+                            std::memory_order_release);
+    }
+    if (child == EXPANDING) {
+      undo_virtual_losses_(leaf->path);
+      return LeafType::COLLISION;
+    }
+    node = child;
+  }
+}
+
+template <int board_size>
+int MCTSPlayer<board_size>::select_edge_(int node, game::Color turn) const {
+  const int first_edge = nodes_[node].first_edge;
+  const int num_edges = nodes_[node].num_edges;
+  // a node's edges are contiguous within their block
+  const float *P = &edges_.P(first_edge);
+  const std::atomic<int> *edge_N = &edges_.N(first_edge);
+  const std::atomic<float> *edge_W = &edges_.W(first_edge);
+  const std::atomic<int> *edge_child = &edges_.child(first_edge);
+  // values are stored from black's perspective; if we are white, we negate
+  // them since we try to minimize
+  const float sign = (turn == game::BLACK ? 1.0f : -1.0f);
+  // take a snapshot of the edges with relaxed loads, which may miss playouts
+  // in flight, so the PUCT scores are computed on plain values
+  alignas(32) int N[board_size * board_size + 1];
+  alignas(32) float Q[board_size * board_size + 1];
   // calculate P(explored) term for FPU
-  float c_fpu_term = 0.0;
-  for (int legal_idx : *(state.get_legal_action_indexes())) {
-    if (map_[state].N[legal_idx] > 0) {
-      c_fpu_term += map_[state].P[legal_idx];
+  float explored_P = 0.0f;
+  for (int i = 0; i < num_edges; ++i) {
+    N[i] = edge_N[i].load(std::memory_order_relaxed);
+    if (N[i] > 0) {
+      explored_P += P[i];
+      // an edge into a node takes the node's value, which also covers
+      // visits through the node's other parents
+      const int child = edge_child[i].load(std::memory_order_acquire);
+      Q[i] = child >= 0
+                 ? sign * nodes_[child].W.load(std::memory_order_relaxed) /
+                       nodes_[child].N.load(std::memory_order_relaxed)
+                 : sign * edge_W[i].load(std::memory_order_relaxed) / N[i];
+    }
+  }
+  const int node_N = nodes_[node].N.load(std::memory_order_relaxed);
+  const float c_fpu_term =
+      sign * nodes_[node].W.load(std::memory_order_relaxed) / node_N -
+      static_cast<float>(MCTS_CFPU) * std::sqrt(explored_P);
+  for (int i = 0; i < num_edges; ++i) {
+    if (N[i] == 0) {
+      Q[i] = c_fpu_term;
     }
   }
-  // if we are white, we take -Q for all Q's since we try to minimize
-  c_fpu_term =
-      (state.get_turn() == game::BLACK ? map_[state].Qs : -map_[state].Qs) -
-      MCTS_CFPU * std::sqrt(c_fpu_term);
-  for (int legal_idx : *(state.get_legal_action_indexes())) {
+  // precompute cpuct * sqrt(sum_a N(s, a)) term for all items
+  const float explore_term =
+      static_cast<float>(MCTS_CPUCT) * std::sqrt(static_cast<float>(node_N));
+  // the most visited root edge is never pruned
+  const int min_N =
+      node == 0 ? root_prune_below_.load(std::memory_order_relaxed) : 0;
+  const int best = puct_argmax(P, N, Q, num_edges, explore_term, min_N);
+  if (best < 0) {
+    throw std::logic_error("invalid mcts action");
+  }
+  return first_edge + best;
+}
+
+template <int board_size>
+int MCTSPlayer<board_size>::puct_argmax(const float *P, const int *N,
+                                        const float *Q, int num_edges,
+                                        float explore_term, int min_N) {
+  float max_u = -100000000.0f;
+  int best = -1;
+  int i = 0;
+#ifdef __AVX2__
+  {
+    // each lane keeps the first best edge among the edges it sees
+    const __m256 explore = _mm256_set1_ps(explore_term);
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    const __m256i min_Ns = _mm256_set1_epi32(min_N);
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 best_us = _mm256_set1_ps(max_u);
+    __m256i bests = _mm256_set1_epi32(-1);
+    for (; i + 8 <= num_edges; i += 8) {
+      const __m256i Ns = _mm256_loadu_si256((const __m256i *)(N + i));
+      const __m256 u = _mm256_add_ps(
+          _mm256_loadu_ps(Q + i),
+          _mm256_div_ps(_mm256_mul_ps(explore, _mm256_loadu_ps(P + i)),
+                        _mm256_add_ps(ones, _mm256_cvtepi32_ps(Ns))));
+      const __m256 better = _mm256_andnot_ps(
+          _mm256_castsi256_ps(_mm256_cmpgt_epi32(min_Ns, Ns)),
+          _mm256_cmp_ps(u, best_us, _CMP_GT_OQ));
+      best_us = _mm256_blendv_ps(best_us, u, better);
+      bests = _mm256_castps_si256(_mm256_blendv_ps(
+          _mm256_castsi256_ps(bests), _mm256_castsi256_ps(lanes), better));
+      lanes = _mm256_add_epi32(lanes, _mm256_set1_epi32(8));
+    }
+    alignas(32) float lane_us[8];
+    alignas(32) int lane_bests[8];
+    _mm256_store_ps(lane_us, best_us);
+    _mm256_store_si256((__m256i *)lane_bests, bests);
+    // ties go to the first edge, as in the scalar loop
+    for (int lane = 0; lane < 8; ++lane) {
+      if (lane_bests[lane] >= 0 &&
+          (lane_us[lane] > max_u ||
+           (lane_us[lane] == max_u && lane_bests[lane] < best))) {
+        max_u = lane_us[lane];
+        best = lane_bests[lane];
+      }
+    }
+  }
+#endif
+  for (; i < num_edges; ++i) {
+    if (N[i] < min_N) {
+      continue;
+    }
     // u = Q(s, a) + cpuct * P(s, a) * sqrt(sum_a N(s, a)) / (1 + N(s, a))
-    float u =
-        (map_[state].N[legal_idx] == 0
-             ? c_fpu_term
-             : (state.get_turn() == game::BLACK ? map_[state].Q[legal_idx]
-                                                : -map_[state].Q[legal_idx])) +
-        MCTS_CPUCT * map_[state].P[legal_idx] * sqrt_term /
-            (1 + map_[state].N[legal_idx]);
+    const float u = Q[i] + explore_term * P[i] / (1 + N[i]);
     if (u > max_u) {
       max_u = u;
-      best_action_idx = legal_idx;
+      best = i;
     }
   }
-  if (best_action_idx < 0) {
-    throw std::logic_error("invalid mcts action");
+  return best;
+}
+
+template <int board_size>
+int MCTSPlayer<board_size>::puct_argmax_scalar(const float *P, const int *N,
+                                               const float *Q, int num_edges,
+                                               float explore_term, int min_N) {
+  float max_u = -100000000.0f;
+  int best = -1;
+  for (int i = 0; i < num_edges; ++i) {
+    if (N[i] < min_N) {
+      continue;
+    }
+    const float u = Q[i] + explore_term * P[i] / (1 + N[i]);
+    if (u > max_u) {
+      max_u = u;
+      best = i;
+    }
   }
-  game::GameState state_copy = state;
-  state_copy.move(game::Action(state.get_turn(), best_action_idx));
-  float result = visit(state_copy);
-  map_[state].Qs =
-      ((map_[state].Qs * map_[state].Ns) + result) / (map_[state].Ns + 1);
-  ++(map_[state].Ns);
-  if (!state_copy.done()) {
-    map_[state].Q[best_action_idx] = map_[state_copy].Qs;
-    map_[state].N[best_action_idx] = map_[state_copy].Ns;
-  } else {
-    // we can't hash finished positions, so we just update manually
-    map_[state].Q[best_action_idx] = result;
-    ++(map_[state].N[best_action_idx]);
+  return best;
+}
+
+template <int board_size>
+void MCTSPlayer<board_size>::backup_(const Path &path, float value) {
+  for (int i = 0; i < path.size(); ++i) {
+    const PathStep &step = path[i];
+    edges_.N(step.edge) += 1 - MCTS_VIRTUAL_LOSS;
+    edges_.W(step.edge) += value - step.virtual_loss;
+    MCTSNode &node = nodes_[step.node];
+    if (i == 0) {
+      ++node.N;
+      node.W += value;
+    } else {
+      node.N += 1 - MCTS_VIRTUAL_LOSS;
+      node.W += value + step.virtual_loss;
+    }
   }
-  return result;
 }
 
-void MCTSPlayer::apply_dirichlet_noise_(const game::GameState &state) {
-  if (state.done()) {
-    return;
+template <int board_size>
+void MCTSPlayer<board_size>::undo_virtual_losses_(const Path &path) {
+  for (int i = 0; i < path.size(); ++i) {
+    const PathStep &step = path[i];
+    edges_.N(step.edge) -= MCTS_VIRTUAL_LOSS;
+    edges_.W(step.edge) -= step.virtual_loss;
+    if (i > 0) {
+      nodes_[step.node].N -= MCTS_VIRTUAL_LOSS;
+      nodes_[step.node].W += step.virtual_loss;
+    }
   }
-  const std::vector<int> legal_actions = *state.get_legal_action_indexes();
-  size_t num_values = legal_actions.size();
+}
+
+template <int board_size>
+void MCTSPlayer<board_size>::apply_dirichlet_noise_(int node) {
+  const int first_edge = nodes_[node].first_edge;
+  size_t num_values = nodes_[node].num_edges;
   const float alpha = DIRICHLET_UNSCALED_ALPHA / num_values;
   // generate dirichlet-distributed vector
   std::gamma_distribution<float> d(alpha, 1);
@@ -202,14 +889,16 @@ void MCTSPlayer::apply_dirichlet_noise_(const game::GameState &state) {
   const float DIRICHLET_EPSILON =
       (eval_mode_) ? DIRICHLET_EPSILON_VAL : DIRICHLET_EPSILON_TRAIN;
   for (size_t i = 0; i < num_values; ++i) {
-    assert(!std::isnan(map_[state].P[legal_actions[i]]));
-    map_[state].P[legal_actions[i]] =
-        (1 - DIRICHLET_EPSILON) * map_[state].P[legal_actions[i]] +
-        DIRICHLET_EPSILON * values[i];
-    // assert(!std::isnan(map_[state].P[legal_actions[i]]));
-    if (std::isnan(map_[state].P[legal_actions[i]])) {
+    float &P = edges_.P(first_edge + i);
+    assert(!std::isnan(P));
+    P = (1 - DIRICHLET_EPSILON) * P + DIRICHLET_EPSILON * values[i];
+    if (std::isnan(P)) {
       std::cout << "Dirichlet noise generated isnan policy\n";
       throw std::logic_error("Dirichlet noise generated isnan policy\n");
     }
   }
 }
+
+template class MCTSPlayer<9>;
+template class MCTSPlayer<13>;
+template class MCTSPlayer<19>;
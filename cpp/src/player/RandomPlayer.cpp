@@ -4,15 +4,23 @@
 
 #include <cassert>
 #include <random>
-#include <vector>
+#include <span>
 
 #include "player/RandomPlayer.h"
 
-RandomPlayer::RandomPlayer() : AbstractPlayer(), gen_(rd_()) {}
+template <int board_size>
+RandomPlayer<board_size>::RandomPlayer()
+    : AbstractPlayer<board_size>(), gen_(rd_()) {}
 
-game::Action RandomPlayer::get_move(game::GameState state) {
-  std::vector<int> legal_move_indexes = *state.get_legal_action_indexes();
+template <int board_size>
+game::Action<board_size>
+RandomPlayer<board_size>::get_move(game::GameState<board_size> state) {
+  std::span<const int> legal_move_indexes = state.get_legal_action_indexes();
   std::uniform_int_distribution<> dist(
       0, static_cast<int>(legal_move_indexes.size() - 1));
   return {state.get_turn(), legal_move_indexes[dist(gen_)]};
 }
+
+template class RandomPlayer<9>;
+template class RandomPlayer<13>;
+template class RandomPlayer<19>;
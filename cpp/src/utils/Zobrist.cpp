@@ -3,6 +3,7 @@
 //
 
 #include "utils/Zobrist.h"
+#include <cassert>
 #include <random>
 
 Zobrist::Zobrist(int features) {
@@ -16,6 +17,9 @@ Zobrist::Zobrist(int features) {
 
 size_t Zobrist::size() const { return values_.size(); }
 
-size_t Zobrist::get_value(size_t index) const { return values_[index]; }
+size_t Zobrist::get_value(size_t index) const {
+  assert(index < values_.size());
+  return values_[index];
+}
 
 std::vector<size_t> Zobrist::get_values() const { return values_; }
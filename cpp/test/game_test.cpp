@@ -5,90 +5,477 @@
 #include <gtest/gtest.h>
 #include "game/Action.h"
 #include "game/GameState.h"
+#include "game/Symmetry.h"
+#include <algorithm>
 #include <iostream>
+#include <random>
+#include <set>
+#include <span>
+#include <vector>
 
 using namespace game;
 
 // Demonstrate ko logic
 TEST(GameTest, GameStateLogicTest) {
-  GameState state(7.5);
+  GameState<9> state(7.5);
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 0, 2));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 0, 2));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PLAY, 0, 1));
+  state.move(Action<9>(Color::WHITE, ActionType::PLAY, 0, 1));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 0, 0));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 0, 0));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PLAY, 1, 0));
+  state.move(Action<9>(Color::WHITE, ActionType::PLAY, 1, 0));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 1, 1));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 1, 1));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PLAY, 8, 8));
+  state.move(Action<9>(Color::WHITE, ActionType::PLAY, 8, 8));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 0, 0));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 0, 0));
   std::cout << state.to_string() << std::endl;
-  EXPECT_EQ(false, state.is_legal_action(Action(Color::WHITE, ActionType::PLAY, 1, 0)));
-  state.move(Action(Color::WHITE, ActionType::PLAY, 5, 5));
-  state.move(Action(Color::BLACK, ActionType::PLAY, 8, 0));
-  state.move(Action(Color::WHITE, ActionType::PLAY, 0, 1));
-  state.move(Action(Color::BLACK, ActionType::PASS));
-  state.move(Action(Color::WHITE, ActionType::PLAY, 0, 0));
-  state.move(Action(Color::BLACK, ActionType::PLAY, 2, 0));
+  EXPECT_EQ(false, state.is_legal_action(Action<9>(Color::WHITE, ActionType::PLAY, 1, 0)));
+  state.move(Action<9>(Color::WHITE, ActionType::PLAY, 5, 5));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 8, 0));
+  state.move(Action<9>(Color::WHITE, ActionType::PLAY, 0, 1));
+  state.move(Action<9>(Color::BLACK, ActionType::PASS));
+  state.move(Action<9>(Color::WHITE, ActionType::PLAY, 0, 0));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 2, 0));
   EXPECT_EQ(state.score(), -2.5);
 }
 
 TEST(GameTest, GameStateLogicTest2) {
-GameState state(7.5);
+GameState<9> state(7.5);
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 0, 0));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 0, 0));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PLAY, 0, 1));
+  state.move(Action<9>(Color::WHITE, ActionType::PLAY, 0, 1));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 1, 1));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 1, 1));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PLAY, 0, 2));
+  state.move(Action<9>(Color::WHITE, ActionType::PLAY, 0, 2));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 1, 2));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 1, 2));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PLAY, 1, 0));
+  state.move(Action<9>(Color::WHITE, ActionType::PLAY, 1, 0));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 0, 3));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 0, 3));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PASS));
+  state.move(Action<9>(Color::WHITE, ActionType::PASS));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 0, 0));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 0, 0));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PLAY, 0, 1));
+  state.move(Action<9>(Color::WHITE, ActionType::PLAY, 0, 1));
   std::cout << state.to_string() << std::endl;
   EXPECT_EQ(state.score(), -7.5);
 }
 
 TEST(GameTest, GameStateLogicTest3) {
-  GameState state(7.5);
+  GameState<9> state(7.5);
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 6, 2));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 6, 2));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PASS));
+  state.move(Action<9>(Color::WHITE, ActionType::PASS));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 5, 2));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 5, 2));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PASS));
+  state.move(Action<9>(Color::WHITE, ActionType::PASS));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 8, 0));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 8, 0));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PASS));
+  state.move(Action<9>(Color::WHITE, ActionType::PASS));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 8, 1));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 8, 1));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PASS));
+  state.move(Action<9>(Color::WHITE, ActionType::PASS));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 7, 1));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 7, 1));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PASS));
+  state.move(Action<9>(Color::WHITE, ActionType::PASS));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::BLACK, ActionType::PLAY, 6, 1));
+  state.move(Action<9>(Color::BLACK, ActionType::PLAY, 6, 1));
   std::cout << state.to_string() << std::endl;
-  state.move(Action(Color::WHITE, ActionType::PLAY, 0, 1));
+  state.move(Action<9>(Color::WHITE, ActionType::PLAY, 0, 1));
   std::cout << state.to_string() << std::endl;
   // EXPECT_EQ(state.score(), -7.5);
-}
\ No newline at end of file
+}
+
+// flood-fills the chain containing index on board, returning its size and
+// number of liberties
+template <int board_size>
+static std::pair<int, int> reference_chain(const Color *board, int index) {
+  bool visited[board_size * board_size] = {};
+  bool liberty[board_size * board_size] = {};
+  std::vector<int> stack = {index};
+  visited[index] = true;
+  int stones = 0;
+  int liberties = 0;
+  while (!stack.empty()) {
+    int i = stack.back();
+    stack.pop_back();
+    ++stones;
+    for (const auto a : neighbors) {
+      int x = i / board_size + a[0];
+      int y = i % board_size + a[1];
+      if (x < 0 || x >= board_size || y < 0 || y >= board_size) {
+        continue;
+      }
+      int j = x * board_size + y;
+      if (board[j] == EMPTY && !liberty[j]) {
+        liberty[j] = true;
+        ++liberties;
+      } else if (board[j] == board[index] && !visited[j]) {
+        visited[j] = true;
+        stack.push_back(j);
+      }
+    }
+  }
+  return {stones, liberties};
+}
+
+// a board plus the side to move, for tracking repeated positions
+using ReferencePosition = std::pair<std::vector<Color>, Color>;
+
+// recomputes legal moves from scratch by playing every point on a copy of the
+// board; independent of GameState's incremental bookkeeping. seen holds every
+// position so far this game
+template <int board_size>
+static std::vector<int>
+reference_legal_indexes(const GameState<board_size> &state,
+                        const std::set<ReferencePosition> &seen,
+                        bool positional_superko) {
+  std::vector<int> legal;
+  const Color turn = state.get_turn();
+  for (int i = 0; i < board_size * board_size; ++i) {
+    Color board[board_size * board_size];
+    std::copy(state.get_board(0), state.get_board(0) + board_size * board_size,
+              board);
+    if (board[i] != EMPTY) {
+      continue;
+    }
+    board[i] = turn;
+    for (const auto a : neighbors) {
+      int x = i / board_size + a[0];
+      int y = i % board_size + a[1];
+      if (x < 0 || x >= board_size || y < 0 || y >= board_size) {
+        continue;
+      }
+      int j = x * board_size + y;
+      if (board[j] == opposite(turn) && reference_chain<board_size>(board, j).second == 0) {
+        // remove the captured chain
+        std::vector<int> stack = {j};
+        Color captured = board[j];
+        board[j] = EMPTY;
+        while (!stack.empty()) {
+          int k = stack.back();
+          stack.pop_back();
+          for (const auto b : neighbors) {
+            int x0 = k / board_size + b[0];
+            int y0 = k % board_size + b[1];
+            if (0 <= x0 && x0 < board_size && 0 <= y0 && y0 < board_size &&
+                board[x0 * board_size + y0] == captured) {
+              board[x0 * board_size + y0] = EMPTY;
+              stack.push_back(x0 * board_size + y0);
+            }
+          }
+        }
+      }
+    }
+    std::pair<int, int> chain = reference_chain<board_size>(board, i);
+    if (chain.first == 4 || chain.second == 0) {
+      continue;
+    }
+    std::vector<Color> new_board(board, board + board_size * board_size);
+    bool repeat = seen.contains({new_board, opposite(turn)}) ||
+                  (positional_superko && seen.contains({new_board, turn}));
+    if (!repeat) {
+      legal.push_back(i);
+    }
+  }
+  legal.push_back(board_size * board_size);
+  return legal;
+}
+
+// a random legal action of state; passes are rare so that random games fill
+// up the board
+template <int board_size>
+static Action<board_size> random_action(const GameState<board_size> &state,
+                                        std::mt19937 &gen) {
+  std::span<const int> legal = state.get_legal_action_indexes();
+  int idx = legal.back();
+  if (legal.size() > 1 && gen() % 20 != 0) {
+    idx = legal[gen() % (legal.size() - 1)];
+  }
+  return {state.get_turn(), idx};
+}
+
+template <int board_size>
+static void check_random_games_against_reference(int num_games,
+                                                 bool positional_superko) {
+  std::mt19937 gen(342);
+  for (int g = 0; g < num_games; ++g) {
+    GameState<board_size> state(7.5, nullptr, positional_superko);
+    std::set<ReferencePosition> seen;
+    while (!state.done()) {
+      seen.insert({std::vector<Color>(state.get_board(0),
+                                      state.get_board(0) +
+                                          board_size * board_size),
+                   state.get_turn()});
+      const std::vector<int> expected =
+          reference_legal_indexes(state, seen, positional_superko);
+      // single actions are checked on their own until the list is made, and
+      // against the list after
+      std::vector<int> checked[2];
+      for (std::vector<int> &legal : checked) {
+        for (int i = 0; i <= board_size * board_size; ++i) {
+          if (state.is_legal_action(Action<board_size>(state.get_turn(), i))) {
+            legal.push_back(i);
+          }
+        }
+        std::span<const int> legal_span = state.get_legal_action_indexes();
+        ASSERT_EQ(std::vector<int>(legal_span.begin(), legal_span.end()),
+                  expected)
+            << state.to_string();
+      }
+      ASSERT_EQ(checked[0], expected) << state.to_string();
+      ASSERT_EQ(checked[1], expected) << state.to_string();
+      state.move(random_action(state, gen));
+    }
+  }
+}
+
+// Incremental legal move generation must agree with a from-scratch reference
+TEST(GameTest, LegalMovesMatchReferenceTest) {
+  check_random_games_against_reference<9>(500, false);
+  check_random_games_against_reference<9>(100, true);
+  check_random_games_against_reference<13>(20, false);
+  check_random_games_against_reference<19>(5, false);
+}
+
+// ~2.5 million positions; run manually after changing move generation
+TEST(GameTest, DISABLED_LegalMovesMatchReferenceLongTest) {
+  check_random_games_against_reference<9>(20000, false);
+  check_random_games_against_reference<9>(5000, true);
+}
+
+template <int board_size> static void check_random_game_hashes(int num_games) {
+  std::mt19937 gen(1);
+  for (int g = 0; g < num_games; ++g) {
+    GameState<board_size> state(7.5);
+    while (!state.done()) {
+      state.move(random_action(state, gen));
+      ASSERT_EQ(state.hash(), state.compute_hash()) << state.to_string();
+    }
+  }
+}
+
+// Incremental Zobrist hashing (including captures) must match a full rehash
+TEST(GameTest, HashMatchesRecomputedHashTest) {
+  check_random_game_hashes<9>(2000);
+  check_random_game_hashes<19>(20);
+}
+
+// ~3 million moves; run manually after changing hashing
+TEST(GameTest, DISABLED_HashMatchesRecomputedHashLongTest) {
+  check_random_game_hashes<9>(25000);
+}
+
+// history_hash(n) tells apart positions that differ within n boards only
+TEST(GameTest, HistoryHashTest) {
+  GameState<9> forward(7.5);
+  GameState<9> backward(7.5);
+  ASSERT_EQ(forward.history_hash(1), forward.hash());
+  ASSERT_EQ(forward.history_hash(GAME_HISTORY_LEN),
+            backward.history_hash(GAME_HISTORY_LEN));
+  // the same three stones in a different order
+  forward.move(Action<9>(BLACK, ActionType::PLAY, 0, 0));
+  forward.move(Action<9>(WHITE, ActionType::PLAY, 4, 4));
+  forward.move(Action<9>(BLACK, ActionType::PLAY, 8, 8));
+  backward.move(Action<9>(BLACK, ActionType::PLAY, 8, 8));
+  backward.move(Action<9>(WHITE, ActionType::PLAY, 4, 4));
+  backward.move(Action<9>(BLACK, ActionType::PLAY, 0, 0));
+  ASSERT_EQ(forward.hash(), backward.hash());
+  ASSERT_EQ(forward.history_hash(1), backward.history_hash(1));
+  ASSERT_NE(forward.history_hash(2), backward.history_hash(2));
+  // passing keeps the boards but not the turn
+  GameState<9> passed = forward;
+  passed.move(Action<9>(WHITE, ActionType::PASS));
+  for (int i = 1; i <= GAME_HISTORY_LEN; ++i) {
+    ASSERT_NE(passed.history_hash(i), forward.history_hash(i));
+  }
+  // identical histories always hash the same
+  GameState<9> copy = forward;
+  copy.move(Action<9>(WHITE, ActionType::PLAY, 2, 2));
+  forward.move(Action<9>(WHITE, ActionType::PLAY, 2, 2));
+  for (int i = 1; i <= GAME_HISTORY_LEN; ++i) {
+    ASSERT_EQ(copy.history_hash(i), forward.history_hash(i));
+  }
+}
+
+// marks every point connected to index without crossing a stone of blocker
+template <int board_size>
+static void reference_reach(const Color *board, int index, Color blocker,
+                            bool *reachable) {
+  std::vector<int> stack = {index};
+  reachable[index] = true;
+  while (!stack.empty()) {
+    int i = stack.back();
+    stack.pop_back();
+    for (const auto a : neighbors) {
+      int x = i / board_size + a[0];
+      int y = i % board_size + a[1];
+      int j = x * board_size + y;
+      if (0 <= x && x < board_size && 0 <= y && y < board_size &&
+          board[j] != blocker && !reachable[j]) {
+        reachable[j] = true;
+        stack.push_back(j);
+      }
+    }
+  }
+}
+
+// area score with komi, counting from scratch the way score() used to
+template <int board_size>
+static float reference_score(const GameState<board_size> &state) {
+  const Color *board = state.get_board(0);
+  bool black_reachable[board_size * board_size] = {};
+  bool white_reachable[board_size * board_size] = {};
+  for (int i = 0; i < board_size * board_size; ++i) {
+    if (board[i] == BLACK) {
+      reference_reach<board_size>(board, i, WHITE, black_reachable);
+    } else if (board[i] == WHITE) {
+      reference_reach<board_size>(board, i, BLACK, white_reachable);
+    }
+  }
+  float count = -state.get_komi();
+  for (int i = 0; i < board_size * board_size; ++i) {
+    count += black_reachable[i] && !white_reachable[i];
+    count -= white_reachable[i] && !black_reachable[i];
+  }
+  return count;
+}
+
+template <int board_size> static void check_random_game_scores(int num_games) {
+  std::mt19937 gen(7);
+  for (int g = 0; g < num_games; ++g) {
+    GameState<board_size> state(7.5);
+    while (!state.done()) {
+      state.move(random_action(state, gen));
+      ASSERT_EQ(state.score(), reference_score(state)) << state.to_string();
+      Color ownership[board_size * board_size];
+      state.get_ownership(ownership);
+      float owned = -state.get_komi();
+      for (Color c : ownership) {
+        owned += static_cast<int>(c);
+      }
+      ASSERT_EQ(state.score(), owned) << state.to_string();
+    }
+  }
+}
+
+// Bitboard area scoring and ownership must agree with a flood-fill reference
+TEST(GameTest, ScoreMatchesReferenceTest) {
+  check_random_game_scores<9>(300);
+  check_random_game_scores<19>(5);
+}
+
+template <int board_size> static void check_symmetries() {
+  constexpr int num_points = board_size * board_size;
+  for (int s = 0; s < NUM_SYMMETRIES; ++s) {
+    const auto &forward = Symmetry<board_size>::forward(s);
+    const auto &inverse = Symmetry<board_size>::inverse(s);
+    ASSERT_EQ(forward[num_points], num_points);
+    std::set<int> images;
+    for (int i = 0; i <= num_points; ++i) {
+      ASSERT_EQ(inverse[forward[i]], i);
+      ASSERT_TRUE(s != 0 || forward[i] == i);
+      images.insert(forward[i]);
+    }
+    ASSERT_EQ(images.size(), num_points + 1);
+    // a symmetry of the board must keep neighbours next to each other
+    for (int i = 0; i < num_points; ++i) {
+      for (int j = 0; j < num_points; ++j) {
+        const int dist = std::abs(i / board_size - j / board_size) +
+                         std::abs(i % board_size - j % board_size);
+        const int new_dist =
+            std::abs(forward[i] / board_size - forward[j] / board_size) +
+            std::abs(forward[i] % board_size - forward[j] % board_size);
+        ASSERT_EQ(dist, new_dist);
+      }
+    }
+  }
+  // the 8 symmetries are all different
+  std::set<std::vector<int>> tables;
+  for (int s = 0; s < NUM_SYMMETRIES; ++s) {
+    const auto &forward = Symmetry<board_size>::forward(s);
+    tables.emplace(forward.begin(), forward.end());
+  }
+  ASSERT_EQ(tables.size(), NUM_SYMMETRIES);
+}
+
+TEST(GameTest, SymmetryTest) {
+  check_symmetries<9>();
+  check_symmetries<19>();
+}
+
+// everything a caller can see of a state
+template <int board_size>
+static void check_same_state(const GameState<board_size> &state,
+                             const GameState<board_size> &expected) {
+  ASSERT_EQ(state.done(), expected.done());
+  ASSERT_EQ(state.hash(), expected.hash());
+  ASSERT_EQ(state.history_hash(GAME_HISTORY_LEN),
+            expected.history_hash(GAME_HISTORY_LEN));
+  ASSERT_EQ(state.get_num_turns(), expected.get_num_turns());
+  ASSERT_EQ(state.get_passes(), expected.get_passes());
+  for (int i = 0; i < GAME_HISTORY_LEN; ++i) {
+    ASSERT_TRUE(std::equal(state.get_board(i),
+                           state.get_board(i) + board_size * board_size,
+                           expected.get_board(i)));
+  }
+  ASSERT_TRUE(std::ranges::equal(state.get_legal_action_indexes(),
+                                 expected.get_legal_action_indexes()));
+  if (state.done()) {
+    ASSERT_EQ(state.winner(), expected.winner());
+  } else {
+    ASSERT_EQ(state.get_turn(), expected.get_turn());
+    ASSERT_EQ(state.score(), expected.score());
+  }
+}
+
+template <int board_size> static void check_random_game_undos(int num_games) {
+  constexpr int depth = 4;
+  std::mt19937 gen(11);
+  for (int g = 0; g < num_games; ++g) {
+    GameState<board_size> state(7.5);
+    // never takes a move back
+    GameState<board_size> reference(7.5);
+    while (!state.done()) {
+      typename GameState<board_size>::Undo undos[depth];
+      GameState<board_size> played = reference;
+      int moves = 0;
+      while (moves < depth && !state.done()) {
+        // lines may also end in a resignation
+        const Action<board_size> action =
+            gen() % 50 == 0 ? Action<board_size>(state.get_turn(), RESIGN)
+                            : random_action(state, gen);
+        state.move(action, &undos[moves++]);
+        played.move(action);
+        check_same_state(state, played);
+      }
+      while (moves > 0) {
+        state.undo_move(undos[--moves]);
+      }
+      check_same_state(state, reference);
+      const Action<board_size> action = random_action(state, gen);
+      state.move(action);
+      reference.move(action);
+    }
+  }
+}
+
+// Playing moves and taking them back must restore the state exactly, so that
+// a search can walk a single state up and down the tree
+TEST(GameTest, UndoMoveTest) {
+  check_random_game_undos<9>(300);
+  check_random_game_undos<19>(5);
+}
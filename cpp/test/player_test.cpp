@@ -5,16 +5,25 @@
 #include <gtest/gtest.h>
 #include <torch/script.h>
 #include <chrono>
+#include <cmath>
+#include <sstream>
 #include <string>
 #include <stdexcept>
+#include <thread>
 #include <mutex>
+#include <random>
+#include <span>
 #include "game/GameState.h"
 #include "player/RandomPlayer.h"
+#include "player/CachingEvaluator.h"
 #include "player/Evaluator.h"
+#include "player/InputEncoder.h"
 #include "player/MCTSPlayer.h"
+#include "player/MCTS_defs.h"
 #include "player/NNEvaluator.h"
 #include "play/Match.h"
 #include "play/GTP.h"
+#include "play/TimeControl.h"
 
 TEST(PlayerTest, DISABLED_GameSpeedTest) {
   constexpr size_t num_iters = 10;
@@ -23,9 +32,9 @@ TEST(PlayerTest, DISABLED_GameSpeedTest) {
   for (size_t j = 0; j < num_iters; ++j) {
     auto start = std::chrono::steady_clock::now();
     for (size_t i = 0; i < num_games; ++i) {
-      game::GameState state(7.5);
-      RandomPlayer black_player;
-      RandomPlayer white_player;
+      game::GameState<9> state(7.5);
+      RandomPlayer<9> black_player;
+      RandomPlayer<9> white_player;
       while (!state.done()) {
         if (state.get_turn() == game::Color::BLACK) {
           state.move(black_player.get_move(state));
@@ -44,10 +53,10 @@ TEST(PlayerTest, DISABLED_GameSpeedTest) {
 }
 
 TEST(PlayerTest, DISABLED_NNTest) {
-  game::GameState state(7.5);
-  std::unique_ptr<Evaluator> eval = std::make_unique<NNEvaluator<1>>("traced_model.pt");
-  MCTSPlayer black_player(std::move(eval));
-  RandomPlayer white_player;
+  game::GameState<9> state(7.5);
+  std::unique_ptr<Evaluator<9>> eval = std::make_unique<NNEvaluator<9>>("traced_model.pt", 1);
+  MCTSPlayer<9> black_player(std::move(eval));
+  RandomPlayer<9> white_player;
   while (!state.done()) {
     if (state.get_turn() == game::Color::BLACK) {
       state.move(black_player.get_move(state));
@@ -62,20 +71,20 @@ TEST(PlayerTest, DISABLED_NNTest) {
 // test NNEvaluator correctness under multiple threads
 TEST(PlayerTest, DISABLED_MultiThreadNNTest) {
   constexpr size_t num_threads = 16;
-  std::shared_ptr<Evaluator> eval = std::make_shared<NNEvaluator<num_threads>>("net3.pt");
-  std::vector<game::GameState> states;
+  std::shared_ptr<Evaluator<9>> eval = std::make_shared<NNEvaluator<9>>("net3.pt", num_threads);
+  std::vector<game::GameState<9>> states;
   std::vector<float> evals;
   states.reserve(num_threads);
   evals.reserve(num_threads);
-  RandomPlayer black_player;
-  RandomPlayer white_player;
+  RandomPlayer<9> black_player;
+  RandomPlayer<9> white_player;
   for (size_t i = 0; i < num_threads; ++i) {
     states.emplace_back(7.5);
     states[i].move(black_player.get_move(states[i]));
     states[i].move(white_player.get_move(states[i]));
   }
   auto task = [&eval, &states, &evals](int tid) {
-    Evaluator::Evaluation x = eval->Evaluate(states[tid]);
+    Evaluator<9>::Evaluation x = eval->Evaluate(states[tid]);
     evals[tid] = x.value_;
     ASSERT_TRUE(evals[tid] < 1.001 && evals[tid] > -1.001);
     float sum = std::accumulate(x.policy_.begin(), x.policy_.end(), 0.0);
@@ -91,9 +100,9 @@ TEST(PlayerTest, DISABLED_MultiThreadNNTest) {
     threads[i].join();
   }
   // check correctness against single-thread mode
-  std::shared_ptr<Evaluator> st_eval = std::make_shared<NNEvaluator<1>>("net3.pt");
+  std::shared_ptr<Evaluator<9>> st_eval = std::make_shared<NNEvaluator<9>>("net3.pt", 1);
   for (size_t i = 0; i < num_threads; ++i) {
-    Evaluator::Evaluation x = st_eval->Evaluate(states[i]);
+    Evaluator<9>::Evaluation x = st_eval->Evaluate(states[i]);
     // account for some rounding errors
     ASSERT_TRUE(abs(x.value_ - evals[i]) < 1e-4);
     // std::cout << x.value_ << ' ' << evals[i] << std::endl;
@@ -106,11 +115,11 @@ TEST(PlayerTest, DISABLED_SpeedTest) {
   size_t num_iters = 10;
   for (size_t j = 0; j < num_iters; ++j) {
     size_t num_threads = 16;
-    std::shared_ptr<Evaluator> eval = std::make_shared<NNEvaluator<4>>("net3.pt");
-    std::vector<game::GameState> states;
+    std::shared_ptr<Evaluator<9>> eval = std::make_shared<NNEvaluator<9>>("net3.pt", 4);
+    std::vector<game::GameState<9>> states;
     states.reserve(num_threads);
-    RandomPlayer black_player;
-    RandomPlayer white_player;
+    RandomPlayer<9> black_player;
+    RandomPlayer<9> white_player;
     for (size_t i = 0; i < num_threads; ++i) {
       states.emplace_back(7.5);
       states[i].move(black_player.get_move(states[i]));
@@ -119,7 +128,7 @@ TEST(PlayerTest, DISABLED_SpeedTest) {
     auto task = [&eval, &states](int tid) {
         float ret = 0;
         for (size_t i = 0; i < 200; ++i) {
-          Evaluator::Evaluation x = eval->Evaluate(states[tid]);
+          Evaluator<9>::Evaluation x = eval->Evaluate(states[tid]);
           // prevent evaluation from being optimized away
           ret += x.value_;
         }
@@ -147,8 +156,507 @@ TEST(PlayerTest, DISABLED_SpeedTest) {
 }
 
 TEST(PlayerTest, DISABLED_GTPTest) {
-  std::shared_ptr<Evaluator> eval = std::make_shared<NNEvaluator<1>>("lognet43.pt");
-  std::shared_ptr<AbstractPlayer> engine = std::make_shared<MCTSPlayer>(eval, 100, true);
-  GTP gtp_runner(engine);
+  std::shared_ptr<Evaluator<9>> eval = std::make_shared<NNEvaluator<9>>("lognet43.pt", 1);
+  std::shared_ptr<AbstractPlayer<9>> engine = std::make_shared<MCTSPlayer<9>>(eval, 100, true);
+  GTP<9> gtp_runner(engine);
   gtp_runner.run();
-}
\ No newline at end of file
+}
+
+// uniform policy and a value from the current score; cheap and thread-safe
+template <int board_size> class ScoreEvaluator : public Evaluator<board_size> {
+public:
+  typename Evaluator<board_size>::Evaluation
+  Evaluate(const game::GameState<board_size> &state) override {
+    constexpr int num_actions = board_size * board_size + 1;
+    typename Evaluator<board_size>::Evaluation evaluation;
+    evaluation.policy_.fill(1.0f / num_actions);
+    evaluation.value_ = std::tanh(state.score() / 10.0f);
+    return evaluation;
+  }
+};
+
+// a policy and value that differ between positions, counting how many
+// positions were evaluated
+class CountingEvaluator : public Evaluator<9> {
+public:
+  Evaluator<9>::Evaluation Evaluate(const game::GameState<9> &state) override {
+    ++evaluated_;
+    Evaluator<9>::Evaluation evaluation;
+    const game::Color *board = state.get_board(0);
+    float sum = 0;
+    for (int i = 0; i < 9 * 9; ++i) {
+      evaluation.policy_[i] = board[i] == game::EMPTY ? 1.0f + i % 7 : 0.0f;
+      sum += evaluation.policy_[i];
+    }
+    evaluation.policy_[9 * 9] = 1.0f;
+    sum += 1.0f;
+    for (float &p : evaluation.policy_) {
+      p /= sum;
+    }
+    evaluation.value_ = std::tanh(state.score() / 10.0f);
+    return evaluation;
+  }
+  size_t evaluated_ = 0;
+};
+
+// repeated positions are served from the cache, close to the evaluator's
+// own results, and only misses reach the evaluator. positions may evict each
+// other, so hits are checked against the cache's own counters
+TEST(PlayerTest, CachingEvaluatorTest) {
+  auto counting = std::make_shared<CountingEvaluator>();
+  CachingEvaluator<9> cache(counting, 1 << 16, 2);
+  auto misses = [&cache]() {
+    auto stats = cache.get_cache_stats();
+    return stats.lookups_ - stats.hits_;
+  };
+  // a fixed game without passes, so that no position below repeats
+  std::mt19937 gen(3);
+  std::vector<game::GameState<9>> states;
+  game::GameState<9> state(7.5);
+  while (states.size() < 50) {
+    states.push_back(state);
+    std::span<const int> legal = state.get_legal_action_indexes();
+    state.move(game::Action<9>(state.get_turn(),
+                               legal[gen() % (legal.size() - 1)]));
+  }
+  auto expect_close = [](const Evaluator<9>::Evaluation &a,
+                         const Evaluator<9>::Evaluation &b) {
+    for (size_t i = 0; i < a.policy_.size(); ++i) {
+      ASSERT_NEAR(a.policy_[i], b.policy_[i], 1e-4);
+    }
+    ASSERT_NEAR(a.value_, b.value_, 1e-4);
+  };
+  for (const auto &s : states) {
+    cache.Evaluate(s);
+  }
+  ASSERT_EQ(counting->evaluated_, misses());
+  for (const auto &s : states) {
+    expect_close(cache.Evaluate(s), counting->Evaluate(s));
+  }
+  // the loop above evaluated each state once more itself
+  ASSERT_EQ(counting->evaluated_, states.size() + misses());
+  ASSERT_GT(cache.get_cache_stats().hits_, states.size() / 2);
+
+  // half new positions, half cached
+  std::vector<game::GameState<9>> next;
+  for (size_t i = 0; i < states.size(); i += 2) {
+    next.push_back(states[i]);
+    game::GameState<9> moved = states[i];
+    moved.move(game::Action<9>(moved.get_turn(), game::PASS));
+    next.push_back(moved);
+  }
+  std::vector<const game::GameState<9> *> batch;
+  for (const auto &s : next) {
+    batch.push_back(&s);
+  }
+  std::vector<Evaluator<9>::Evaluation> evaluations(batch.size());
+  const uint64_t hits = cache.get_cache_stats().hits_;
+  cache.EvaluateBatch(batch, evaluations.data());
+  ASSERT_EQ(counting->evaluated_, states.size() + misses());
+  ASSERT_GT(cache.get_cache_stats().hits_ - hits, 0);
+  for (size_t i = 0; i < next.size(); ++i) {
+    expect_close(evaluations[i], counting->Evaluate(next[i]));
+  }
+}
+
+// the sum of the visits in a playout log, "C[<action> <visits>,...]"
+static int logged_visits(const std::string &log) {
+  int visits = 0;
+  std::stringstream ss(log.substr(2));
+  int idx, n;
+  char comma;
+  while (ss >> idx >> n >> comma) {
+    visits += n;
+  }
+  return visits;
+}
+
+// plays a game against a random player, checking that every playout of each
+// search is backed up. black's searches log their visits. with reuse_tree,
+// the player is also told every move and searches white's moves without a
+// log, going on from the subtree for the new position
+static void check_mcts_backs_up_playouts(int search_threads,
+                                         int leaf_batch_size,
+                                         bool reuse_tree = false) {
+  constexpr int playouts = 400;
+  std::shared_ptr<Evaluator<9>> eval = std::make_shared<ScoreEvaluator<9>>();
+  MCTSPlayer<9> player(eval, playouts, true, false, 0, 0, search_threads,
+                       leaf_batch_size);
+  RandomPlayer<9> opponent;
+  game::GameState<9> state(7.5);
+  while (!state.done()) {
+    game::Action<9> action = opponent.get_move(state);
+    if (state.get_turn() == game::BLACK) {
+      // a logged search is a training target, so it never reuses visits;
+      // the first playout is the root
+      std::string log;
+      action = player.get_move(state, &log);
+      ASSERT_EQ(logged_visits(log), playouts - 1);
+    } else if (reuse_tree) {
+      // a player searching both sides always finds the last move in its
+      // tree. a reused node may bring more visits, through its other parents
+      const uint64_t visits = player.get_reuse_stats().total_visits_;
+      action = player.get_move(state);
+      ASSERT_GE(player.get_reuse_stats().total_visits_ - visits, playouts);
+    }
+    ASSERT_TRUE(state.is_legal_action(action));
+    state.move(action);
+    if (reuse_tree) {
+      player.play(action);
+    }
+  }
+  MCTSPlayer<9>::ReuseStats stats = player.get_reuse_stats();
+  if (reuse_tree) {
+    ASSERT_GE(stats.total_visits_, stats.searches_ * playouts);
+  } else {
+    ASSERT_EQ(stats.total_visits_, stats.searches_ * playouts);
+  }
+  if (reuse_tree) {
+    ASSERT_GT(stats.reused_searches_, 0);
+    ASSERT_GT(stats.reused_visits_, 0);
+  } else {
+    ASSERT_EQ(stats.reused_visits_, 0);
+  }
+}
+
+// a search shared by several threads must still back up every playout
+TEST(PlayerTest, MultiThreadMCTSTest) { check_mcts_backs_up_playouts(8, 1); }
+
+// so must one that evaluates its leaves in batches
+TEST(PlayerTest, LeafBatchMCTSTest) {
+  check_mcts_backs_up_playouts(1, 16);
+  check_mcts_backs_up_playouts(4, 8);
+}
+
+// and one that goes on from the previous move's tree
+TEST(PlayerTest, TreeReuseMCTSTest) {
+  check_mcts_backs_up_playouts(1, 1, true);
+  check_mcts_backs_up_playouts(4, 8, true);
+}
+
+// pondering on the opponent's time, whether it finishes or is cut short by
+// the opponent's move, leaves a tree the next search goes on from
+TEST(PlayerTest, PonderMCTSTest) {
+  constexpr int playouts = 200;
+  std::shared_ptr<Evaluator<9>> eval = std::make_shared<ScoreEvaluator<9>>();
+  MCTSPlayer<9> player(eval, playouts, true, false, 0, 0, 2, 4, 2 * playouts);
+  RandomPlayer<9> opponent;
+  game::GameState<9> state(7.5);
+  int moves = 0;
+  while (!state.done()) {
+    game::Action<9> action = opponent.get_move(state);
+    if (state.get_turn() == game::BLACK) {
+      action = player.get_move(state);
+    } else if (moves % 4 == 1) {
+      // let the search run for a while; otherwise stop it right away
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_TRUE(state.is_legal_action(action));
+    state.move(action);
+    player.play(action);
+    player.ponder(state);
+    ++moves;
+  }
+  player.stop_pondering();
+  MCTSPlayer<9>::ReuseStats stats = player.get_reuse_stats();
+  ASSERT_GE(stats.total_visits_, stats.searches_ * playouts);
+  ASSERT_GT(stats.reused_visits_, 0);
+}
+
+// a policy on a few points, so that searches reach the same positions by
+// different move orders
+class FewPointsEvaluator : public Evaluator<9> {
+public:
+  Evaluator<9>::Evaluation Evaluate(const game::GameState<9> &state) override {
+    Evaluator<9>::Evaluation evaluation;
+    evaluation.policy_.fill(0.001f);
+    for (int i : {20, 24, 56, 60}) {
+      evaluation.policy_[i] = 0.2f;
+    }
+    evaluation.value_ = std::tanh(state.score() / 10.0f);
+    return evaluation;
+  }
+};
+
+// a move out of turn drops the tree without writing to stdout, which GTP
+// uses for its replies
+TEST(PlayerTest, OutOfTurnPlayMCTSTest) {
+  std::shared_ptr<Evaluator<9>> eval = std::make_shared<ScoreEvaluator<9>>();
+  MCTSPlayer<9> player(eval, 50, true);
+  game::GameState<9> state(7.5);
+  player.get_move(state);
+  testing::internal::CaptureStdout();
+  player.play(game::Action<9>(game::WHITE, game::PASS));
+  ASSERT_EQ(testing::internal::GetCapturedStdout(), "");
+  player.get_move(state);
+  ASSERT_EQ(player.get_reuse_stats().reused_searches_, 0);
+}
+
+// transposed positions share one node, and every playout is still backed up
+// to the root once
+TEST(PlayerTest, TranspositionMCTSTest) {
+  constexpr int playouts = 400;
+  std::shared_ptr<Evaluator<9>> eval = std::make_shared<FewPointsEvaluator>();
+  for (int search_threads : {1, 4}) {
+    MCTSPlayer<9> player(eval, playouts, true, false, 0, 0, search_threads,
+                         search_threads);
+    game::GameState<9> state(7.5);
+    for (int i = 0; i < 4; ++i) {
+      std::string log;
+      game::Action<9> action = player.get_move(state, &log);
+      ASSERT_EQ(logged_visits(log), playouts - 1);
+      state.move(action);
+      player.play(action);
+    }
+    ASSERT_GT(player.get_transpositions(), 0);
+  }
+}
+
+// searches that stop early make up the playouts they report saved, and only
+// once moves are no longer sampled
+TEST(PlayerTest, PruningMCTSTest) {
+  constexpr int playouts = 200;
+  std::shared_ptr<Evaluator<9>> eval = std::make_shared<ScoreEvaluator<9>>();
+  for (MCTSPruning pruning :
+       {MCTSPruning::NONE, MCTSPruning::STOP_EARLY,
+        MCTSPruning::PRUNE_CHILDREN}) {
+    MCTSPlayer<9> player(eval, playouts, true, false, 0, 0, 1, 1, 0, pruning);
+    RandomPlayer<9> opponent;
+    game::GameState<9> state(7.5);
+    uint64_t sampled_visits = 0;
+    while (!state.done()) {
+      game::Action<9> action = opponent.get_move(state);
+      if (state.get_turn() == game::BLACK) {
+        const uint64_t visits = player.get_reuse_stats().total_visits_;
+        action = player.get_move(state);
+        if (state.get_num_turns() < TEMP_0_MOVE_NUM_VAL) {
+          sampled_visits += player.get_reuse_stats().total_visits_ - visits;
+        }
+      }
+      ASSERT_TRUE(state.is_legal_action(action));
+      state.move(action);
+      player.play(action);
+    }
+    MCTSPlayer<9>::ReuseStats reuse_stats = player.get_reuse_stats();
+    MCTSPlayer<9>::PruningStats pruning_stats = player.get_pruning_stats();
+    // reused nodes may bring more visits than the target
+    ASSERT_GE(reuse_stats.total_visits_ + pruning_stats.saved_playouts_,
+              reuse_stats.searches_ * playouts);
+    ASSERT_GE(sampled_visits, (TEMP_0_MOVE_NUM_VAL / 2) * playouts);
+    if (pruning == MCTSPruning::NONE) {
+      ASSERT_EQ(pruning_stats.stopped_searches_, 0);
+    } else {
+      ASSERT_GT(pruning_stats.stopped_searches_, 0);
+      ASSERT_GT(pruning_stats.saved_playouts_, 0);
+    }
+  }
+}
+
+// the vectorized PUCT selection picks the same edge as the scalar loop,
+// including ties, pruned edges and counts that aren't a multiple of the
+// vector width
+TEST(PlayerTest, PuctArgmaxTest) {
+  constexpr int max_edges = 19 * 19 + 1;
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<float> prior(0.0f, 1.0f);
+  std::uniform_int_distribution<int> visits(0, 20);
+  // few distinct values, so that ties are common
+  std::uniform_int_distribution<int> value(-4, 4);
+  std::vector<float> P(max_edges);
+  std::vector<int> N(max_edges);
+  std::vector<float> Q(max_edges);
+  for (int trial = 0; trial < 10000; ++trial) {
+    const int num_edges = trial % (max_edges + 1);
+    const bool uniform = trial % 3 == 0;
+    for (int i = 0; i < num_edges; ++i) {
+      P[i] = uniform ? 1.0f / num_edges : prior(gen);
+      N[i] = uniform ? 0 : visits(gen);
+      Q[i] = value(gen) / 4.0f;
+    }
+    const float explore_term = prior(gen) * 10;
+    const int min_N = trial % 5 == 0 ? visits(gen) : 0;
+    ASSERT_EQ(MCTSPlayer<9>::puct_argmax(P.data(), N.data(), Q.data(),
+                                         num_edges, explore_term, min_N),
+              MCTSPlayer<9>::puct_argmax_scalar(P.data(), N.data(), Q.data(),
+                                                num_edges, explore_term, min_N));
+  }
+}
+
+// a ScoreEvaluator that takes a millisecond per position
+class SlowEvaluator : public ScoreEvaluator<9> {
+public:
+  Evaluator<9>::Evaluation Evaluate(const game::GameState<9> &state) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return ScoreEvaluator<9>::Evaluate(state);
+  }
+};
+
+// a time budget ends the search well before the playout target, and the
+// playout target still caps a search with time to spare. evaluations take at
+// least a millisecond, so a slower machine only gets fewer visits into the
+// budget
+TEST(PlayerTest, TimedMCTSTest) {
+  constexpr int playouts = 400;
+  std::shared_ptr<Evaluator<9>> eval = std::make_shared<SlowEvaluator>();
+  MCTSPlayer<9> player(eval, playouts, true);
+  game::GameState<9> state(7.5);
+  // about 100 evaluations, plus playouts that end the game without one
+  player.set_time_budget(0.1);
+  state.move(player.get_move(state));
+  const uint64_t timed_visits = player.get_reuse_stats().total_visits_;
+  ASSERT_LE(timed_visits, playouts / 2);
+  ASSERT_GT(timed_visits, 1);
+  // moves are still sampled, so the search doesn't stop early
+  player.set_time_budget(60);
+  player.get_move(state);
+  ASSERT_EQ(player.get_reuse_stats().total_visits_ - timed_visits, playouts);
+}
+
+// moves get a share of main time, the byo-yomi allowance on top, and never
+// more than is left on the clock
+TEST(PlayerTest, TimeControlTest) {
+  TimeControl<9> time_control;
+  ASSERT_FALSE(time_control.is_limited());
+  time_control.set_time_settings(0, 10, 0);
+  ASSERT_FALSE(time_control.is_limited());
+  time_control.set_time_settings(0, 0, 0);
+  ASSERT_FALSE(time_control.is_limited());
+  // absolute: 60 seconds over at least TIME_MIN_MOVES_LEFT moves
+  time_control.set_time_settings(60, 0, 0);
+  ASSERT_TRUE(time_control.is_limited());
+  ASSERT_DOUBLE_EQ(time_control.allocate(game::BLACK, 50),
+                   60.0 / TIME_MIN_MOVES_LEFT);
+  ASSERT_LT(time_control.allocate(game::BLACK, 0),
+            time_control.allocate(game::BLACK, 50));
+  time_control.spend(game::BLACK, 59);
+  ASSERT_DOUBLE_EQ(time_control.allocate(game::BLACK, 50),
+                   TIME_MIN_MOVE_SECONDS);
+  ASSERT_DOUBLE_EQ(time_control.allocate(game::WHITE, 50),
+                   60.0 / TIME_MIN_MOVES_LEFT);
+  time_control.reset_clocks();
+  ASSERT_DOUBLE_EQ(time_control.allocate(game::BLACK, 50),
+                   60.0 / TIME_MIN_MOVES_LEFT);
+  // canadian: 30 seconds for 5 moves
+  time_control.set_time_settings(0, 30, 5);
+  ASSERT_DOUBLE_EQ(time_control.allocate(game::BLACK, 50),
+                   TIME_BYO_YOMI_FACTOR * 30 / 5);
+  time_control.spend(game::BLACK, 20);
+  ASSERT_DOUBLE_EQ(time_control.allocate(game::BLACK, 50),
+                   TIME_BYO_YOMI_FACTOR * 10 / 4);
+  for (int i = 0; i < 4; ++i) {
+    time_control.spend(game::BLACK, 1);
+  }
+  ASSERT_DOUBLE_EQ(time_control.allocate(game::BLACK, 50),
+                   TIME_BYO_YOMI_FACTOR * 30 / 5);
+  time_control.set_time_left(game::WHITE, 1, 1);
+  ASSERT_DOUBLE_EQ(time_control.allocate(game::WHITE, 50),
+                   1 - TIME_LAG_SECONDS);
+  // japanese: every move gets most of a period
+  time_control.set_byo_yomi_periods(0, 10, 3);
+  time_control.spend(game::BLACK, 25);
+  ASSERT_DOUBLE_EQ(time_control.allocate(game::BLACK, 50),
+                   TIME_BYO_YOMI_FACTOR * 10);
+  time_control.set_unlimited();
+  ASSERT_FALSE(time_control.is_limited());
+}
+
+// kgs-time_settings answers known time systems with success and rejects the
+// rest, as GTP requires for unsupported arguments
+TEST(PlayerTest, GTPTimeSettingsTest) {
+  std::shared_ptr<AbstractPlayer<9>> engine =
+      std::make_shared<RandomPlayer<9>>();
+  GTP<9> gtp_runner(engine);
+  std::istringstream input("kgs-time_settings canadian 60 30 5\n"
+                           "kgs-time_settings fischer 60 10\n"
+                           "quit\n");
+  std::streambuf *cin_buf = std::cin.rdbuf(input.rdbuf());
+  testing::internal::CaptureStdout();
+  gtp_runner.run();
+  const std::string output = testing::internal::GetCapturedStdout();
+  std::cin.rdbuf(cin_buf);
+  ASSERT_EQ(output, "=\n\n? unknown time system\n\n=\n\n");
+}
+
+// every plane matches the history boards, for each supported history length
+TEST(PlayerTest, InputEncoderTest) {
+  constexpr int num_points = 9 * 9;
+  RandomPlayer<9> player;
+  game::GameState<9> state(7.5);
+  std::vector<float> planes((2 * GAME_HISTORY_LEN + 1) * num_points);
+  while (!state.done()) {
+    const game::Color own = state.get_turn();
+    for (int history_len = 1; history_len <= GAME_HISTORY_LEN;
+         ++history_len) {
+      InputEncoder<9> encoder(history_len);
+      encoder.encode(state, planes.data());
+      for (int i = 0; i < history_len; ++i) {
+        const game::Color *board = state.get_board(i);
+        for (int j = 0; j < num_points; ++j) {
+          ASSERT_EQ(planes[2 * i * num_points + j], board[j] == own ? 1 : 0);
+          ASSERT_EQ(planes[(2 * i + 1) * num_points + j],
+                    board[j] == game::opposite(own) ? 1 : 0);
+        }
+      }
+      for (int j = 0; j < num_points; ++j) {
+        ASSERT_EQ(planes[2 * history_len * num_points + j],
+                  own == game::BLACK ? 1 : 0);
+      }
+    }
+    state.move(player.get_move(state));
+  }
+  EXPECT_THROW(InputEncoder<9>(0), std::invalid_argument);
+  EXPECT_THROW(InputEncoder<9>(GAME_HISTORY_LEN + 1), std::invalid_argument);
+}
+
+// encoding under a symmetry moves every plane value to its transformed point
+TEST(PlayerTest, InputEncoderSymmetryTest) {
+  constexpr int num_points = 9 * 9;
+  RandomPlayer<9> player;
+  game::GameState<9> state(7.5);
+  InputEncoder<9> encoder(GAME_HISTORY_LEN);
+  const int num_planes = encoder.get_num_planes();
+  std::vector<float> planes(num_planes * num_points);
+  std::vector<float> transformed(num_planes * num_points);
+  while (!state.done()) {
+    encoder.encode(state, planes.data());
+    for (int s = 0; s < NUM_SYMMETRIES; ++s) {
+      const auto &forward = game::Symmetry<9>::forward(s);
+      encoder.encode(state, transformed.data(), s);
+      for (int p = 0; p < num_planes; ++p) {
+        for (int j = 0; j < num_points; ++j) {
+          ASSERT_EQ(transformed[p * num_points + forward[j]],
+                    planes[p * num_points + j]);
+        }
+      }
+    }
+    state.move(player.get_move(state));
+  }
+}
+
+TEST(PlayerTest, DISABLED_InputEncoderSpeedTest) {
+  constexpr size_t num_encodes = 1000000;
+  // positions from random games, so that history boards are filled in
+  std::vector<game::GameState<19>> states;
+  RandomPlayer<19> player;
+  game::GameState<19> state(7.5);
+  while (states.size() < 200) {
+    state.move(player.get_move(state));
+    if (state.done()) {
+      state = game::GameState<19>(7.5);
+    } else {
+      states.push_back(state);
+    }
+  }
+  for (int history_len : {NN_DEFAULT_HISTORY_LEN, GAME_HISTORY_LEN}) {
+    InputEncoder<19> encoder(history_len);
+    std::vector<float> planes(encoder.get_num_planes() * 19 * 19);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_encodes; ++i) {
+      encoder.encode(states[i % states.size()], planes.data());
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> diff = end - start;
+    std::cout << "history " << history_len << ": "
+              << diff.count() / num_encodes * 1e9 << "ns per encode\n";
+  }
+}
@@ -0,0 +1,49 @@
+//
+// Created by Jeremy on 2/13/2022.
+//
+
+#include "utils/MPSCQueue.h"
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+class Item : public MPSCNode {
+public:
+  int producer;
+  int sequence;
+};
+
+// every pushed item is popped exactly once, in order per producer
+TEST(UtilsTest, MPSCQueueTest) {
+  constexpr int num_producers = 8;
+  constexpr int items_per_producer = 20000;
+  MPSCQueue<Item> queue;
+  std::vector<Item> items(num_producers * items_per_producer);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < num_producers; ++p) {
+    producers.emplace_back([&queue, &items, p]() {
+      for (int i = 0; i < items_per_producer; ++i) {
+        Item *item = &items[p * items_per_producer + i];
+        item->producer = p;
+        item->sequence = i;
+        queue.push(item);
+      }
+    });
+  }
+  std::vector<int> next_sequence(num_producers, 0);
+  int popped = 0;
+  while (popped < num_producers * items_per_producer) {
+    Item *item = queue.pop();
+    if (item == nullptr) {
+      std::this_thread::yield();
+      continue;
+    }
+    ASSERT_EQ(item->sequence, next_sequence[item->producer]);
+    ++next_sequence[item->producer];
+    ++popped;
+  }
+  for (std::thread &t : producers) {
+    t.join();
+  }
+  EXPECT_EQ(queue.pop(), nullptr);
+}
@@ -16,8 +16,11 @@ SAMPLE_PLAYOUT_NUM = 599
 
 # TODO: make this less hacky
 # ONLY WORKS FOR BOARD_SIZE <= 9
-def read_from_sgf(game_dir, save_file):
+# if ownership_file is given, each game's final ownership (1 for black, -1 for
+# white, 0 for neither) is saved there in the same order as the games
+def read_from_sgf(game_dir, save_file, ownership_file=None):
     fout = open(save_file, "ab+")
+    fown = open(ownership_file, "ab+") if ownership_file is not None else None
     for root, dirs, files in os.walk(game_dir, topdown=False):
         with concurrent.futures.ProcessPoolExecutor() as executor:
             results = []
@@ -26,18 +29,23 @@ def read_from_sgf(game_dir, save_file):
                 results.append(executor.submit(save, filename))
 
             for f in tqdm(concurrent.futures.as_completed(results)):
-                states, actions, winner = f.result()
+                states, actions, winner, ownership = f.result()
                 np.save(fout, states)
                 np.save(fout, actions)
                 np.save(fout, winner)
+                if fown is not None:
+                    np.save(fown, ownership)
 
     fout.close()
+    if fown is not None:
+        fown.close()
 
 def save(filename):
     with open(filename, 'r') as file_object:
         game = Game(BOARD_SIZE, handi=0, komi=7.5, gui=False)
         states = []
         actions = []
+        ownership = np.zeros(BOARD_SIZE * BOARD_SIZE, dtype=np.int8)
         while True:
             try:
                 line = file_object.readline()
@@ -63,11 +71,15 @@ def save(filename):
                             action_dist = [i / num_playouts for i in action_dist]
                             actions.append(action_dist)
                         game.move(action)
+                elif line.startswith("XO["):
+                    owners = line[3:line.find(']')]
+                    assert (len(owners) == BOARD_SIZE * BOARD_SIZE)
+                    ownership = np.array([1 if c == 'B' else -1 if c == 'W' else 0 for c in owners], dtype=np.int8)
                 elif line.find("RE[") != -1:
                     winner = WHITE if line.find("RE[W") != -1 else BLACK
             except EOFError:
                 break
-        return(states, actions, winner)
+        return(states, actions, winner, ownership)
 
 
 def generate_training_data(num_games, save_train_file, save_val_file, train_split=0.8, playouts=50):
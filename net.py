@@ -76,6 +76,8 @@ class OutBlock(nn.Module):
 class Net(nn.Module):
     def __init__(self, board_size, num_filters, num_blocks):
         super(Net, self).__init__()
+        # saved with the scripted model; the engine reads it to pick a board size
+        self.board_size = board_size
         self.blocks = [ConvBlock(num_filters, board_size)]
         for i in range(num_blocks):
             self.blocks.append(ResBlock(num_filters))